@@ -1,8 +1,14 @@
 #pragma once
 
 #include <Utils/glm.hpp>
+#include <Utils/Half.hpp>
+#include <Utils/FlagGrid.hpp>
+#include <Utils/FlagNormals.hpp>
 #include <vector>
 
+// Distance beyond its radius at which a sphere pushes the flag away
+static const float SPHERE_COLLISION_MARGIN = 0.05f;
+
 struct Sphere {
   glm::vec3 center;
   float radius;
@@ -10,36 +16,179 @@ struct Sphere {
   Sphere(glm::vec3 center, float radius): center(center), radius(radius){};
 };
 
-struct Flag {
+// Order of the vertices in the arrays
+enum FlagLayout {
+    ROW_MAJOR, // k = i + j * gridWidth
+    TILED // Square tiles of TILE_SIZE vertices, see TiledGrid
+};
+
+// Springs starting from the vertex (i, j), one bit each in the spring mask
+enum SpringDirection {
+    SPRING_RIGHT, // (i + 1, j)
+    SPRING_DOWN, // (i, j + 1)
+    SPRING_DOWN_RIGHT, // (i + 1, j + 1)
+    SPRING_DOWN_LEFT, // (i - 1, j + 1)
+    SPRING_RIGHT2, // (i + 2, j)
+    SPRING_DOWN2, // (i, j + 2)
+    SPRING_DIRECTION_COUNT
+};
+
+// Storage type of the velocities for a given storage scalar
+template<typename Storage> struct StoredVec3 { typedef glm::detail::tvec3<Storage, glm::defaultp> type; };
+template<> struct StoredVec3<half> { typedef half3 type; };
+
+// Stiffness and damping of the three spring topologies (direct, cross, 2-step)
+template<typename Real>
+struct SpringMaterial {
+    Real K[3];
+    Real V[3];
+};
+
+// Real is the arithmetic type. Storage is the type in which velocities are kept between
+// steps: Real itself, or half to move fewer bytes per step. The rest lengths are shared
+// scalars, and the masses stay in Real: rounded once, they would bias every acceleration
+// for the whole run, and the light vertices of fine grids fall into the half subnormals.
+template<typename Real, typename Storage = Real>
+struct BasicFlag {
+    typedef glm::detail::tvec2<Real, glm::defaultp> vec2;
+    typedef glm::detail::tvec3<Real, glm::defaultp> vec3;
+
     unsigned int gridWidth, gridHeight; // Grid size
+    FlagLayout layout;
 
     // Points physics properties
-    std::vector<glm::vec3> positionArray;
-    std::vector<glm::vec3> velocityArray;
-    std::vector<float> massArray;
-    std::vector<glm::vec3> forceArray;
+    std::vector<vec3> positionArray;
+    std::vector<typename StoredVec3<Storage>::type> velocityArray;
+    std::vector<Real> massArray;
+    std::vector<vec3> forceArray;
 
     // Initial distances
-    glm::vec2 L0;
-    float L1;
-    glm::vec2 L2;
+    vec2 L0;
+    Real L1;
+    vec2 L2;
 
     // Resistance parameters
-    float K0, K1, K2;
+    Real K0, K1, K2;
     // Brake parameters
-    float V0, V1, V2;
+    Real V0, V1, V2;
+
+    // Materials by region : springs use the material of the vertex they start from.
+    // Material 0 is the default one, kept equal to K0, K1, K2 and V0, V1, V2.
+    std::vector<SpringMaterial<Real> > materialArray;
+    std::vector<uint8_t> materialIndexArray;
+
+    // Tearing : springs stretched past (1 + tearStrain) times their rest length break, 0 disables it.
+    // The mask stays empty, and the spring kernel free of tests, until tearing is enabled.
+    Real tearStrain;
+    std::vector<uint8_t> springMaskArray; // Intact springs of each vertex, by SpringDirection bit
+    std::vector<uint> tornTriangleArray; // Triangles of the row-major grid that lost an edge, cleared by the renderer's owner
+
+    // Aerodynamics : drag along the relative air velocity and lift across it, on each triangle
+    Real dragCoefficient, liftCoefficient;
+    // Normals of the triangles, numbered as in tearSpring. Computed once per step by
+    // applyAerodynamicForces from the positions before the step: call computeNormals()
+    // after it before handing them to the renderer.
+    Utils::FlagNormals normals;
+    std::vector<vec3> faceForceArray, relativeVelocityArray;
+    std::vector<uint8_t> faceTornArray; // Empty until a triangle loses an edge
+
+    // Sleeping : square tiles of vertices at rest are skipped by every pass
+    static const uint TILE_SIZE = 8;
+    Real sleepThreshold; // Kinetic energy per unit mass under which a tile rests, 0 disables sleeping
+    uint tileCountX, tileCountY;
+    std::vector<uint8_t> tileSleepingArray;
+    std::vector<uint16_t> tileQuietStepArray; // Consecutive steps under the threshold
+    std::vector<uint8_t> tileActiveArray; // Springs starting in the tile reach an awake tile
+    std::vector<uint> tileWakeArray; // Tiles woken at the end of the step
+    std::vector<vec3> fieldForceArray; // Field of applyExternalForces at the last awake step of each vertex
+    std::vector<Real> tileFieldChangeArray; // Largest squared change of that field per unit mass, on sleeping tiles
+    uint sleepingTileCount;
+
+    // Wake conditions : external forces and colliders of the previous step
+    glm::vec3 externalForce, lastExternalForce;
+    std::vector<Sphere> colliderArray;
+    uint colliderCount;
+
+    // Positions reordered for the renderer when the layout is tiled
+    std::vector<vec3> rowMajorPositionArray;
+
+    // Temporal blocking : state after the blocked step, swapped in at its end
+    static const uint BLOCK_SIZE = 64;
+    std::vector<vec3> blockPositionArray;
+    std::vector<typename StoredVec3<Storage>::type> blockVelocityArray;
 
-    Flag(float mass, float width, float height, uint gridWidth, uint gridHeight);
+    // The tiled layout needs a grid size multiple of TILE_SIZE, it falls back to row-major otherwise
+    BasicFlag(Real mass, Real width, Real height, uint gridWidth, uint gridHeight, FlagLayout layout = ROW_MAJOR);
 
     // Compute internal forces except on fixed points
-    void applyInternalForces(float dt);
+    void applyInternalForces(Real dt);
 
     // Compute external forces (gravity, wind) except on fixed points
     void applyExternalForce(const glm::vec3 &F);
 
+    // Compute the aerodynamic forces of the air moving at wind, plus windArray[k] at the vertex k
+    // when given, except on fixed points
+    void applyAerodynamicForces(const glm::vec3 &wind, const glm::vec3 *windArray = nullptr);
+
+    // Update normals from the current positions
+    void computeNormals();
+
+    // Compute external forces varying over the flag, F[k] on the vertex k, except on fixed points.
+    // A sleeping tile wakes once the field changed under it enough to move it.
+    void applyExternalForces(const glm::vec3 *F);
+
     // Update speed and position with Leapfrog method
-    void update(float dt);
+    void update(Real dt);
 
     // Sphere Collision
-    void sphereCollision(const Sphere &sphere, float dt);
+    void sphereCollision(const Sphere &sphere, Real dt);
+
+    // Advance substepCount full steps (external force F, springs, colliders, update) block by
+    // block: each block of BLOCK_SIZE x BLOCK_SIZE vertices is copied with a halo of 2 vertices
+    // per substep, the reach of the springs, and advanced while it stays in cache. Equivalent
+    // to substepCount calls of the individual passes. Sleeping tiles are woken. A flag that
+    // can tear is stepped pass by pass.
+    void stepBlocked(Real dt, uint substepCount, const glm::vec3 &F, const std::vector<Sphere> &spheres);
+
+    // Add a material (at most 256), return its index
+    uint addMaterial(Real K0, Real K1, Real K2, Real V0, Real V1, Real V2);
+
+    // Springs starting from the vertices [i0, i1) x [j0, j1) use the material
+    void setMaterial(uint i0, uint j0, uint i1, uint j1, uint material);
+
+    // Largest K0 + K1 + K2 of the materials
+    Real maxStiffness() const;
+
+    // Break the spring starting from (i, j), and record the triangles it was an edge of.
+    // Triangle 2 * (i + j * (gridWidth - 1)) + t is the t-th triangle of the quad (i, j).
+    void tearSpring(uint i, uint j, SpringDirection direction);
+
+    // Wake every tile, and resize the tile arrays to the grid
+    void wakeAll();
+
+    // Position of the vertex (i, j) in the arrays
+    uint index(uint i, uint j) const {
+        if (layout == TILED)
+            return TiledGrid<TILE_SIZE>(gridWidth, gridHeight).index(i, j);
+        return i + j * gridWidth;
+    }
+
+    // Positions in row-major order, as expected by FlagRenderer3D
+    const vec3* rowMajorPositions();
+
+    uint tileIndex(uint i, uint j) const {
+        return i / TILE_SIZE + (j / TILE_SIZE) * tileCountX;
+    }
+
+    bool isTileAwake(int ti, int tj) const {
+        return ti >= 0 && tj >= 0 && ti < int(tileCountX) && tj < int(tileCountY) && !tileSleepingArray[ti + tj * tileCountX];
+    }
 };
+
+typedef BasicFlag<float> Flag;
+
+// Reference precision for validation runs
+typedef BasicFlag<double> FlagDouble;
+
+// fp32 arithmetic with fp16 velocities
+typedef BasicFlag<float, half> FlagHalf;
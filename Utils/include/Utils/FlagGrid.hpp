@@ -0,0 +1,66 @@
+#pragma once
+
+#include <sys/types.h>
+
+// Stencil policies for the flag kernels: map grid coordinates to a vertex index.
+// With StaticGrid the size is a compile time constant, so the index math and the
+// loop bounds of the kernels are folded and unrolled by the compiler. The bounds
+// are only constant while the whole rows are walked, that is with no tile asleep.
+
+// Grid size known at compile time
+template<uint W, uint H>
+struct StaticGrid {
+    constexpr uint width() const {
+        return W;
+    }
+
+    constexpr uint height() const {
+        return H;
+    }
+
+    constexpr uint index(uint i, uint j) const {
+        return i + j * W;
+    }
+};
+
+// Grid size known at run time, fallback for the sizes without specialisation
+struct DynamicGrid {
+    uint gridWidth, gridHeight;
+
+    DynamicGrid(uint gridWidth, uint gridHeight): gridWidth(gridWidth), gridHeight(gridHeight) {}
+
+    uint width() const {
+        return gridWidth;
+    }
+
+    uint height() const {
+        return gridHeight;
+    }
+
+    uint index(uint i, uint j) const {
+        return i + j * gridWidth;
+    }
+};
+
+// Vertices stored by square tiles of T x T, row-major inside a tile and tiles in
+// row-major order, so that vertical neighbours are T vertices away instead of a
+// whole row. The grid size must be a multiple of T.
+template<uint T>
+struct TiledGrid {
+    uint gridWidth, gridHeight;
+    uint tileCountX;
+
+    TiledGrid(uint gridWidth, uint gridHeight): gridWidth(gridWidth), gridHeight(gridHeight), tileCountX(gridWidth / T) {}
+
+    uint width() const {
+        return gridWidth;
+    }
+
+    uint height() const {
+        return gridHeight;
+    }
+
+    uint index(uint i, uint j) const {
+        return ((i / T) + (j / T) * tileCountX) * T * T + (i % T) + (j % T) * T;
+    }
+};
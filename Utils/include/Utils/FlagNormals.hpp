@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Utils/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace Utils {
+
+// Normals of a row-major grid of positions, shared by the simulation and the renderer.
+// Each face normal is computed once, four quads at a time from a structure-of-arrays copy
+// of the positions; vertices then gather the six faces around them. Rows are split
+// between threads when OpenMP is enabled.
+class FlagNormals {
+public:
+    FlagNormals();
+
+    // Normals of the two triangles of each quad, split as the index buffer of FlagRenderer3D:
+    // triangle 2 * (i + j * (gridWidth - 1)) + t. Their length is twice the triangle area.
+    void computeFaceNormals(const glm::vec3* positionArray, uint32_t gridWidth, uint32_t gridHeight);
+
+    const std::vector<glm::vec3>& getFaceNormals() const {
+        return m_FaceNormalArray;
+    }
+
+    // Unit vertex normals, area weighted, gathered on first use after computeFaceNormals
+    const std::vector<glm::vec3>& getVertexNormals();
+
+    uint32_t getGridWidth() const {
+        return m_nGridWidth;
+    }
+
+    uint32_t getGridHeight() const {
+        return m_nGridHeight;
+    }
+
+private:
+    uint32_t m_nGridWidth, m_nGridHeight;
+
+    std::vector<float> m_XArray, m_YArray, m_ZArray; // Positions
+    std::vector<glm::vec3> m_FaceNormalArray;
+    std::vector<glm::vec3> m_VertexNormalArray;
+    bool m_bVertexNormalsValid;
+};
+
+}
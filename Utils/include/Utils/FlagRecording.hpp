@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Utils/glm.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Utils {
+
+// Recording file layout:
+//   FlagRecordingHeader
+//   frameCount frames of gridWidth * gridHeight packed glm::vec3 positions
+//   frameCount FlagRecordingIndexEntry (frame index, written on close)
+struct FlagRecordingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t gridWidth, gridHeight;
+    uint32_t frameCount;
+    uint64_t indexOffset;
+};
+
+struct FlagRecordingIndexEntry {
+    uint64_t offset;
+    float time;
+    uint32_t padding;
+};
+
+// Append the flag positions of each simulation frame to a file
+class FlagRecorder {
+public:
+    FlagRecorder(const char* path, uint32_t gridWidth, uint32_t gridHeight);
+
+    ~FlagRecorder();
+
+    FlagRecorder(const FlagRecorder&) = delete;
+
+    FlagRecorder& operator =(const FlagRecorder&) = delete;
+
+    // Nothing more is written once a write failed
+    void addFrame(const glm::vec3* positionArray, float time);
+
+    // Write the frame index and the final header, called by the destructor.
+    // After a failed write the placeholder header is kept, marking the recording invalid.
+    bool close();
+
+private:
+    // Report the first failed write
+    bool checkWrite(bool written);
+
+    std::string m_Path;
+    FILE* m_pFile;
+    bool m_bFailed;
+    FlagRecordingHeader m_Header;
+    std::vector<FlagRecordingIndexEntry> m_Index;
+};
+
+// Memory-map a recording: frames are read in place, without any copy
+class FlagPlayback {
+public:
+    FlagPlayback(const char* path);
+
+    ~FlagPlayback();
+
+    FlagPlayback(const FlagPlayback&) = delete;
+
+    FlagPlayback& operator =(const FlagPlayback&) = delete;
+
+    uint32_t getGridWidth() const {
+        return m_pHeader->gridWidth;
+    }
+
+    uint32_t getGridHeight() const {
+        return m_pHeader->gridHeight;
+    }
+
+    uint32_t getFrameCount() const {
+        return m_pHeader->frameCount;
+    }
+
+    float getFrameTime(uint32_t frame) const {
+        return m_pIndex[frame].time;
+    }
+
+    // Positions of a frame, pointing directly into the mapping
+    const glm::vec3* getFrame(uint32_t frame) const {
+        return reinterpret_cast<const glm::vec3*>(m_pData + m_pIndex[frame].offset);
+    }
+
+    // Last frame recorded at or before a simulation time
+    uint32_t findFrame(float time) const;
+
+    // Ask the kernel to page in a frame before it is drawn
+    void prefetch(uint32_t frame) const;
+
+private:
+    const uint8_t* m_pData;
+    size_t m_nSize;
+
+    const FlagRecordingHeader* m_pHeader;
+    const FlagRecordingIndexEntry* m_pIndex;
+};
+
+}
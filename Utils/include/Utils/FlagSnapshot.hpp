@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Utils/Flag.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Utils {
+
+// Write the full simulation state (flag and colliders) to a binary snapshot
+bool saveSnapshot(const char* path, const Flag& flag, const std::vector<Sphere>& spheres);
+
+// Restore a snapshot written by saveSnapshot, return false if the file is missing or invalid
+bool loadSnapshot(const char* path, Flag& flag, std::vector<Sphere>& spheres);
+
+// Hash of everything the settled state depends on: the initial flag state, the
+// colliders, the external forces and the settling schedule
+uint64_t snapshotKey(const Flag& flag, const std::vector<Sphere>& spheres,
+                     const glm::vec3& gravity, const glm::vec3& wind,
+                     float dt, uint32_t stepCount);
+
+// Cache of settled states, one snapshot per key in a directory
+class SnapshotCache {
+public:
+    SnapshotCache(const std::string& directory);
+
+    bool load(uint64_t key, Flag& flag, std::vector<Sphere>& spheres) const;
+
+    bool save(uint64_t key, const Flag& flag, const std::vector<Sphere>& spheres) const;
+
+private:
+    std::string getPath(uint64_t key) const;
+
+    std::string m_Directory;
+};
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Utils/glm.hpp"
+#include <glm/gtc/packing.hpp>
+#include <cstdint>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+// 16-bit float storage. Values are converted to float for any arithmetic.
+struct half {
+    uint16_t bits;
+
+    half() {}
+
+    half(float value) {
+#ifdef __F16C__
+        bits = _cvtss_sh(value, 0);
+#else
+        bits = glm::packHalf1x16(value);
+#endif
+    }
+
+    operator float() const {
+#ifdef __F16C__
+        return _cvtsh_ss(bits);
+#else
+        return glm::unpackHalf1x16(bits);
+#endif
+    }
+};
+
+struct half3 {
+    half x, y, z;
+
+    half3() {}
+
+    template<typename T>
+    half3(const glm::detail::tvec3<T, glm::defaultp> &v): x(float(v.x)), y(float(v.y)), z(float(v.z)) {}
+
+    template<typename T>
+    operator glm::detail::tvec3<T, glm::defaultp>() const {
+        return glm::detail::tvec3<T, glm::defaultp>(float(x), float(y), float(z));
+    }
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+
+namespace Utils {
+
+// OpenGL 3.3 core context without any window, for batch machines without a display: an
+// EGL context on Mesa's surfaceless platform when available (llvmpipe or a render node),
+// drawing into a framebuffer object of the given size.
+class HeadlessContext {
+public:
+    HeadlessContext(uint32_t width, uint32_t height);
+
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext&) = delete;
+
+    HeadlessContext& operator =(const HeadlessContext&) = delete;
+
+    uint32_t getWidth() const {
+        return m_nWidth;
+    }
+
+    uint32_t getHeight() const {
+        return m_nHeight;
+    }
+
+private:
+    uint32_t m_nWidth, m_nHeight;
+
+    void* m_pDisplay; // EGLDisplay
+    void* m_pContext; // EGLContext
+
+    GLuint m_FBOID;
+    GLuint m_RenderbufferIDs[2]; // Color and depth
+};
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+
+// Frames encoded on a worker thread: a Y4M video (4:2:0) when the path ends with .y4m,
+// otherwise one PNG per frame, the path being a printf pattern of the frame number such
+// as frame%04d.png. Frames are RGBA rows from the bottom up, as read by glReadPixels.
+// A pattern without exactly one integer conversion, or with any other %, is rejected
+// with std::runtime_error.
+class ImageSequenceWriter {
+public:
+    ImageSequenceWriter(const std::string& path, uint32_t width, uint32_t height, uint32_t framerate = 60);
+
+    // Waits for the pending frames to be written
+    ~ImageSequenceWriter();
+
+    ImageSequenceWriter(const ImageSequenceWriter&) = delete;
+
+    ImageSequenceWriter& operator =(const ImageSequenceWriter&) = delete;
+
+    // Buffer of width * height * 4 bytes for the next frame, recycled from the written ones
+    std::vector<uint8_t> takeBuffer();
+
+    // Queue the frame, waiting when the worker is too far behind
+    void addFrame(std::vector<uint8_t>&& pixels);
+
+    uint32_t getWidth() const {
+        return m_nWidth;
+    }
+
+    uint32_t getHeight() const {
+        return m_nHeight;
+    }
+
+private:
+    // Frames queued before addFrame waits for the worker
+    static const size_t MAX_QUEUED_FRAME_COUNT = 8;
+
+    void run();
+
+    void writePNG(const std::vector<uint8_t>& pixels, uint32_t frameIndex);
+
+    void writeY4M(const std::vector<uint8_t>& pixels);
+
+    std::string m_Path;
+    uint32_t m_nWidth, m_nHeight;
+    FILE* m_pVideoFile; // Y4M output, null for PNG
+
+    std::deque<std::vector<uint8_t>> m_FrameQueue;
+    std::vector<std::vector<uint8_t>> m_FreeBuffers;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    bool m_bDone;
+
+    // Scratch of the worker
+    std::vector<uint8_t> m_EncodedData, m_RowData;
+
+    std::thread m_Thread;
+};
+
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Grid size from which the per-vertex and per-row loops of the simulation, the normals and
+// the vertex fill are split between OpenMP threads. Below it the fork and join cost more
+// than the loops themselves.
+static const uint32_t PARALLEL_VERTEX_COUNT = 4096;
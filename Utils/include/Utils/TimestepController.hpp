@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Utils/Flag.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Utils {
+
+// Split each frame in substeps as large as the explicit integrator allows.
+// A substep that produces NaN or an energy blow-up is rolled back and retried
+// with a smaller timestep.
+class TimestepController {
+public:
+    TimestepController(float minDt, float maxDt);
+
+    // Advance the flag by frameDt, step(dt) doing one integration step.
+    // Returns the time advanced, less than frameDt once the substep budget is spent.
+    float advance(Flag& flag, float frameDt, const std::function<void(float)>& step);
+
+    // Largest stable timestep for the current state of the flag
+    float estimateStableTimestep(const Flag& flag) const;
+
+    float getTimestep() const {
+        return m_fDt;
+    }
+
+    uint32_t getSubstepCount() const {
+        return m_nSubstepCount;
+    }
+
+    uint32_t getRollbackCount() const {
+        return m_nRollbackCount;
+    }
+
+private:
+    float kineticEnergy(const Flag& flag) const;
+
+    float m_fDt, m_fMinDt, m_fMaxDt;
+
+    uint32_t m_nSubstepCount; // During the last frame
+    uint32_t m_nRollbackCount; // Since the start
+    uint32_t m_nStableStepCount; // Since the last rollback
+
+    // State before the current substep
+    std::vector<glm::vec3> m_SavedPositionArray;
+    std::vector<glm::vec3> m_SavedVelocityArray;
+    std::vector<uint8_t> m_SavedSpringMaskArray;
+    size_t m_nSavedTornTriangleCount;
+    std::vector<uint8_t> m_SavedFaceTornArray;
+    std::vector<uint8_t> m_SavedTileSleepingArray;
+    std::vector<uint16_t> m_SavedTileQuietStepArray;
+    uint32_t m_nSavedSleepingTileCount;
+};
+
+}
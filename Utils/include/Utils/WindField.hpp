@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Utils/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace Utils {
+
+// Turbulent wind: curl of a noise potential, so that the air swirls without sources
+// or sinks. The noise is only evaluated on a coarse lattice at two key times, blended
+// once per step; vertices sample the blended lattice with trilinear interpolation.
+class WindField {
+public:
+    // Lattice of resolution^3 nodes over the box [minCorner, maxCorner], positions
+    // outside of the box take the wind of its border
+    WindField(const glm::vec3& minCorner, const glm::vec3& maxCorner, uint32_t resolution = 9);
+
+    // Animate the field, a key lattice being evaluated each time a key time is passed
+    void setTime(float time);
+
+    // Wind at each position
+    void sample(const glm::vec3* positionArray, glm::vec3* windArray, size_t count) const;
+
+    float getStrength() const {
+        return m_fStrength;
+    }
+
+    // Scale of the unit curl noise
+    void setStrength(float strength) {
+        m_fStrength = strength;
+    }
+
+    // Noise frequency, in swirls per unit of length
+    void setFrequency(float frequency) {
+        m_fFrequency = frequency;
+        m_bKeysValid = false;
+    }
+
+    // Time between two key lattices, the field changing completely over a few of them
+    void setKeyInterval(float keyInterval) {
+        m_fKeyInterval = keyInterval;
+        m_bKeysValid = false;
+    }
+
+private:
+    // Vector potential, whose curl is the wind
+    glm::vec3 potential(const glm::vec3& position, float time) const;
+
+    void computeKeyLattice(float time, std::vector<glm::vec4>& lattice);
+
+    glm::vec3 m_MinCorner;
+    glm::vec3 m_InvCellSize;
+    uint32_t m_nResolution;
+
+    float m_fStrength, m_fFrequency, m_fKeyInterval;
+    float m_fKeyTime; // Time of the first key lattice
+    bool m_bKeysValid;
+
+    // vec4 nodes, so that a node is a single SIMD load
+    std::vector<glm::vec4> m_KeyLatticeArray[2];
+    std::vector<glm::vec4> m_LatticeArray; // Blended for the current time, scaled by the strength
+    std::vector<glm::vec3> m_PotentialArray; // Scratch of computeKeyLattice
+};
+
+}
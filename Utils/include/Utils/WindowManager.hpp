@@ -24,7 +24,18 @@ public:
     }
 
     // Update window and return elapsed time
-    float update();
+    float update() {
+        swapBuffers();
+        return waitFrame();
+    }
+
+    // Present the frame, blocking when the driver throttles the application
+    void swapBuffers() {
+        SDL_GL_SwapBuffers();
+    }
+
+    // Wait for the end of the frame duration and return elapsed time
+    float waitFrame();
 
     void setFramerate(uint32_t fps) {
         m_nFPS = fps;
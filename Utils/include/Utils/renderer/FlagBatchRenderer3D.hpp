@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Utils/glm.hpp"
+#include <GL/glew.h>
+
+namespace Utils {
+
+// Many flags of the same grid size drawn with a single instanced call. The positions of all
+// the flags are packed one after the other in a buffer texture: each instance fetches the
+// vertices of its own flag and rebuilds their normals from the grid neighbours. The strips
+// and the program are shared, the model matrices come from an instance buffer.
+class FlagBatchRenderer3D {
+public:
+    FlagBatchRenderer3D(uint gridWidth, uint gridHeight, uint maxFlagCount);
+
+    ~FlagBatchRenderer3D();
+
+    FlagBatchRenderer3D(const FlagBatchRenderer3D&) = delete;
+
+    FlagBatchRenderer3D& operator =(const FlagBatchRenderer3D&) = delete;
+
+    // Flag k has the row-major positions positionArrays[k] and the rigid transform modelMatrices[k],
+    // at most maxFlagCount flags being drawn
+    void drawFlags(const glm::vec3* const* positionArrays, const glm::mat4* modelMatrices, uint flagCount, bool wireframe);
+
+    void setProjMatrix(const glm::mat4& P) {
+        m_bMatricesDirty |= P != m_ProjMatrix;
+        m_ProjMatrix = P;
+    }
+
+    void setViewMatrix(const glm::mat4& V) {
+        m_bMatricesDirty |= V != m_ViewMatrix;
+        m_ViewMatrix = V;
+    }
+
+private:
+    static const GLchar *VERTEX_SHADER, *FRAGMENT_SHADER;
+
+    // OpenGL
+    GLuint m_ProgramID;
+    GLuint m_PositionBufferID, m_PositionTextureID;
+    GLuint m_ModelMatrixBufferID;
+    GLuint m_VAOID, m_IBOID;
+
+    GLint m_uVPMatrix, m_uViewMatrix;
+
+    glm::mat4 m_ProjMatrix;
+    glm::mat4 m_ViewMatrix;
+    bool m_bMatricesDirty; // Not uploaded since they changed
+
+    int m_nGridWidth, m_nGridHeight;
+    uint32_t m_nMaxFlagCount;
+    uint32_t m_nIndexCount;
+    GLenum m_IndexType;
+    GLuint m_nRestartIndex;
+    GLsizei m_nVertexSize; // A vec3, or a vec4 without RGB32F buffer textures
+};
+
+}
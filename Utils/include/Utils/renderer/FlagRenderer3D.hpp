@@ -1,18 +1,41 @@
 #pragma once
 
 #include "Utils/glm.hpp"
+#include "Utils/FlagNormals.hpp"
 #include <GL/glew.h>
 #include <vector>
 
 namespace Utils {
 
+// Layout of the vertices streamed every frame
+enum VertexFormat {
+    VERTEX_FULL, // float position and normal, 24 bytes
+    VERTEX_PACKED_NORMAL, // float position, octahedral normal in 2 x snorm16, 16 bytes
+    VERTEX_COMPACT, // position in 3 x unorm16 over the bounding box of the frame, packed normal, 12 bytes
+    VERTEX_POSITION_ONLY // float position read from a buffer texture, the vertex shader rebuilds the
+                         // normals from the grid neighbours, 12 bytes (16 without RGB32F buffer textures)
+};
+
 class FlagRenderer3D {
 	struct Vertex {
 		glm::vec3 position;
 		glm::vec3 normal;
 	};
+
+    struct PackedNormalVertex {
+        glm::vec3 position;
+        GLuint normal;
+    };
+
+    struct CompactVertex {
+        GLushort position[4]; // The fourth one keeps the normal aligned
+        GLuint normal;
+    };
 public:
-    FlagRenderer3D(uint gridWidth, uint gridHeight);
+    // Levels of detail, the level l drawing every 2^l-th row and column
+    static const uint32_t LEVEL_OF_DETAIL_COUNT = 3;
+
+    FlagRenderer3D(uint gridWidth, uint gridHeight, VertexFormat vertexFormat = VERTEX_FULL);
 
     ~FlagRenderer3D();
 
@@ -22,32 +45,102 @@ public:
 
 	void clear();
 
+	// The vertices are written straight into the mapped buffer, by bands of rows on several
+	// threads for large grids when OpenMP is enabled
 	void drawGrid(const glm::vec3* positionArray, bool wireframe);
 
+    // With normals already computed for these positions, by the simulation for instance
+    void drawGrid(const glm::vec3* positionArray, FlagNormals& normals, bool wireframe);
+
+    // Stop drawing these triangles (see Flag::tearSpring for the numbering): the strips
+    // are split around them, only the rows holding them being rewritten in the index buffer
+    void removeTriangles(const uint* triangleArray, size_t count);
+
+    // Coarsest level whose quads, of size quadSize at this distance from the camera, still
+    // cover a few pixels of a viewport of the given height
+    uint selectLevelOfDetail(float quadSize, float distance, uint viewportHeight) const;
+
+    // The simulation is untouched, only the index range drawn changes
+    void setLevelOfDetail(uint level) {
+        m_nLevelOfDetail = glm::min(level, LEVEL_OF_DETAIL_COUNT - 1);
+    }
+
     void setProjMatrix(const glm::mat4& P) {
+        m_bMatricesDirty |= P != m_ProjMatrix;
 		m_ProjMatrix = P;
 	}
 
     void setViewMatrix(const glm::mat4& V) {
+        m_bMatricesDirty |= V != m_ViewMatrix;
 		m_ViewMatrix = V;
 	}
 
 private:
-	static const GLchar *VERTEX_SHADER, *FRAGMENT_SHADER;
+    // Vertices of the frame to fill: in place in the mapped ring, or in m_VertexBuffer
+    GLubyte* beginVertices();
+
+    // Upload the vertices if they are not mapped, and draw them
+    void draw(bool wireframe);
+
+    // Triangle strips of each row of quads for each level of detail, the levels one after the
+    // other, each row drawn by a multi-draw. The rows are packed as long as nothing is torn.
+    // From the first tear on, every row has a slot large enough for its most torn strips, so
+    // that a tear only rewrites the rows it crosses.
+    void uploadIndices();
+
+    template<typename Index>
+    void uploadIndices();
+
+    // Rewrite the slots of dirtyRows[level], the rows of each level whose triangles changed
+    template<typename Index>
+    void uploadIndexRows(const std::vector<int>* dirtyRows);
+
+    // Draw list of a level from its rows, without the empty ones which some drivers
+    // do not skip in a multi-draw
+    void updateDrawRows(uint32_t level);
+
+    // Frames in flight in the mapped ring
+    static const uint32_t RING_SECTION_COUNT = 3;
+
+	static const GLchar *VERTEX_SHADER, *COMPACT_VERTEX_SHADER, *POSITION_ONLY_VERTEX_SHADER, *FRAGMENT_SHADER;
 
     // OpenGL
     GLuint m_ProgramID;
     GLuint m_VBOID, m_VAOID, m_IBOID;
+    GLuint m_PositionTextureID; // Buffer texture over the VBO, for VERTEX_POSITION_ONLY
 
     GLint m_uMVPMatrix, m_uMVMatrix;
+    GLint m_uPositionOffset, m_uPositionScale;
+    GLint m_uFirstVertex;
 
     glm::mat4 m_ProjMatrix;
     glm::mat4 m_ViewMatrix;
+    bool m_bMatricesDirty; // Not uploaded since they changed
 
     int m_nGridWidth, m_nGridHeight;
-    uint32_t m_nIndexCount;
-
-    std::vector<Vertex> m_VertexBuffer;
+    std::vector<GLsizei> m_RowIndexCounts[LEVEL_OF_DETAIL_COUNT]; // Indices of each row
+    std::vector<const GLvoid*> m_RowIndexOffsets[LEVEL_OF_DETAIL_COUNT]; // Start of each row or of its slot in the IBO, in bytes
+    std::vector<GLsizei> m_DrawIndexCounts[LEVEL_OF_DETAIL_COUNT]; // Non-empty rows, as drawn
+    std::vector<const GLvoid*> m_DrawIndexOffsets[LEVEL_OF_DETAIL_COUNT];
+    std::vector<GLint> m_RowBaseVertices; // Ring section of every row, for the multi-draw
+    uint32_t m_nLevelOfDetail;
+    GLenum m_IndexType; // GL_UNSIGNED_SHORT as long as the vertices of a frame fit
+    GLuint m_nRestartIndex;
+    std::vector<bool> m_TornTriangleArray; // Empty until a triangle is removed
+
+    VertexFormat m_VertexFormat;
+    GLsizei m_nVertexSize;
+    size_t m_nVertexCount;
+    std::vector<GLubyte> m_VertexBuffer;
+
+    // Quantised positions are offset + scale * [0, 1]
+    glm::vec3 m_PositionOffset, m_PositionScale;
+
+    // Persistently mapped VBO of RING_SECTION_COUNT frames, null when falling back to orphaning
+    GLubyte* m_pMappedVertices;
+    GLsync m_SectionFences[RING_SECTION_COUNT]; // Signaled when the GPU is done with a section
+    uint32_t m_nSection;
+    FlagNormals m_Normals;
 };
 
 }
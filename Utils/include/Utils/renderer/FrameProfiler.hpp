@@ -0,0 +1,91 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Utils {
+
+// CPU and GPU time of the passes of a frame. The GPU time comes from GL_TIME_ELAPSED queries,
+// two per pass used on alternate frames: a query is only read a frame after it was issued and
+// if its result is already there, so that the CPU never waits for the GPU. Passes may not nest,
+// and each one runs at most once per frame.
+class FrameProfiler {
+public:
+    explicit FrameProfiler(const std::vector<std::string>& passNames);
+
+    ~FrameProfiler();
+
+    FrameProfiler(const FrameProfiler&) = delete;
+
+    FrameProfiler& operator =(const FrameProfiler&) = delete;
+
+    void begin(uint32_t pass);
+
+    void end(uint32_t pass);
+
+    // Read back the queries of the previous frame, which are reused by the next one
+    void endFrame();
+
+    // Without GL_ARB_timer_query the GPU times stay at 0
+    bool hasGPUTimes() const {
+        return m_bTimerQueries;
+    }
+
+    uint32_t getPassCount() const {
+        return m_PassNames.size();
+    }
+
+    const std::string& getPassName(uint32_t pass) const {
+        return m_PassNames[pass];
+    }
+
+    // Milliseconds per frame, smoothed over the last frames. The references stay valid, for the GUI.
+    const float& getCPUTime(uint32_t pass) const {
+        return m_CPUTimes[pass];
+    }
+
+    const float& getGPUTime(uint32_t pass) const {
+        return m_GPUTimes[pass];
+    }
+
+    const float& getCPUTotal() const {
+        return m_fCPUTotal;
+    }
+
+    const float& getGPUTotal() const {
+        return m_fGPUTotal;
+    }
+
+    // Average of each pass since the start
+    void printSummary(std::ostream& out) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::vector<std::string> m_PassNames;
+    bool m_bTimerQueries;
+
+    // Query of the pass p for the frame parity s: m_QueryIDs[2 * p + s]
+    std::vector<GLuint> m_QueryIDs;
+    std::vector<bool> m_QueryIssued;
+    uint32_t m_nParity;
+
+    Clock::time_point m_PassStart;
+    std::vector<float> m_FrameCPUTimes; // Of the current frame, 0 for the passes which did not run
+
+    uint32_t m_nFrameIndex;
+
+    std::vector<float> m_CPUTimes, m_GPUTimes;
+    float m_fCPUTotal, m_fGPUTotal;
+
+    // For the summary, without the warm-up frames
+    std::vector<double> m_CPUSums, m_GPUSums;
+    uint32_t m_nFrameCount;
+    std::vector<uint32_t> m_GPUSampleCounts; // Results are dropped when late
+};
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Utils/ImageSequenceWriter.hpp"
+#include <GL/glew.h>
+
+namespace Utils {
+
+// Asynchronous readback of the framebuffer through a ring of pixel buffer objects: a frame
+// is only mapped when its slot comes round again, the GPU being long done with it, and is
+// then handed over to the writer's worker thread.
+class FrameReader {
+public:
+    explicit FrameReader(ImageSequenceWriter& writer);
+
+    // Hands the frames still in the ring over to the writer
+    ~FrameReader();
+
+    FrameReader(const FrameReader&) = delete;
+
+    FrameReader& operator =(const FrameReader&) = delete;
+
+    // Start reading the frame just drawn
+    void readFrame();
+
+    // Hand every frame read so far over to the writer
+    void flush();
+
+private:
+    static const uint32_t RING_SIZE = 3;
+
+    // Wait for the slot's transfer, and pass its pixels on
+    void collect(uint32_t slot);
+
+    ImageSequenceWriter& m_Writer;
+    GLuint m_PBOIDs[RING_SIZE];
+    GLsync m_Fences[RING_SIZE]; // Null when the slot holds no frame
+    uint32_t m_nNextSlot;
+};
+
+}
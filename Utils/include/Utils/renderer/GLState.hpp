@@ -0,0 +1,232 @@
+#pragma once
+
+#include <GL/glew.h>
+
+namespace Utils {
+
+// Shadow of the OpenGL state shared by the renderers: a call only reaches the driver when it
+// changes the value last set. Every draw sets what it needs and leaves it set, the next one
+// only paying for what differs. Vertex arrays are the exception, they are unbound again so
+// that no buffer bound later lands in one of them.
+//
+// State changed behind its back, e.g. by the GUI, must be reported with invalidate(), the next
+// call of each kind then reaching the driver again.
+class GLState {
+public:
+    enum Capability {
+        DEPTH_TEST,
+        BLEND,
+        CULL_FACE,
+        SCISSOR_TEST,
+        LINE_SMOOTH,
+        PRIMITIVE_RESTART,
+        CAPABILITY_COUNT
+    };
+
+    // Texture units whose bindings are tracked, the others are always forwarded
+    static const GLuint TEXTURE_UNIT_COUNT = 4;
+
+    struct Rect {
+        GLint x, y;
+        GLsizei width, height;
+
+        bool operator ==(const Rect& other) const {
+            return x == other.x && y == other.y && width == other.width && height == other.height;
+        }
+    };
+
+    // One context per process
+    static GLState& current() {
+        static GLState state;
+        return state;
+    }
+
+    GLState() {
+        invalidate();
+    }
+
+    void invalidate() {
+        for(Cached<bool>& capability : m_Capabilities) {
+            capability.valid = false;
+        }
+        m_Program.valid = m_VertexArray.valid = m_PolygonMode.valid = false;
+        m_BlendFunc[0].valid = m_BlendFunc[1].valid = false;
+        m_ActiveTexture.valid = false;
+        for(GLuint unit = 0; unit < TEXTURE_UNIT_COUNT; ++unit) {
+            m_Textures2D[unit].valid = m_TextureBuffers[unit].valid = false;
+        }
+        m_Viewport.valid = m_Scissor.valid = false;
+        m_LineWidth.valid = m_RestartIndex.valid = false;
+    }
+
+    void enable(Capability cap, bool enabled = true) {
+        if(m_Capabilities[cap].differs(enabled)) {
+            if(enabled) {
+                glEnable(capabilityEnum(cap));
+            } else {
+                glDisable(capabilityEnum(cap));
+            }
+            m_Capabilities[cap].set(enabled);
+        }
+    }
+
+    void disable(Capability cap) {
+        enable(cap, false);
+    }
+
+    void useProgram(GLuint program) {
+        if(m_Program.differs(program)) {
+            glUseProgram(program);
+            m_Program.set(program);
+        }
+    }
+
+    void bindVertexArray(GLuint vertexArray) {
+        if(m_VertexArray.differs(vertexArray)) {
+            glBindVertexArray(vertexArray);
+            m_VertexArray.set(vertexArray);
+        }
+    }
+
+    // For both faces, the only choice of a core profile
+    void polygonMode(GLenum mode) {
+        if(m_PolygonMode.differs(mode)) {
+            glPolygonMode(GL_FRONT_AND_BACK, mode);
+            m_PolygonMode.set(mode);
+        }
+    }
+
+    void blendFunc(GLenum source, GLenum destination) {
+        if(m_BlendFunc[0].differs(source) || m_BlendFunc[1].differs(destination)) {
+            glBlendFunc(source, destination);
+            m_BlendFunc[0].set(source);
+            m_BlendFunc[1].set(destination);
+        }
+    }
+
+    void activeTexture(GLenum unit) {
+        if(m_ActiveTexture.differs(unit)) {
+            glActiveTexture(unit);
+            m_ActiveTexture.set(unit);
+        }
+    }
+
+    // On the active unit
+    void bindTexture(GLenum target, GLuint texture) {
+        if(!m_ActiveTexture.valid) {
+            // Any unit may change
+            for(GLuint unit = 0; unit < TEXTURE_UNIT_COUNT; ++unit) {
+                m_Textures2D[unit].valid = m_TextureBuffers[unit].valid = false;
+            }
+        }
+        Cached<GLuint>* binding = textureBinding(target);
+        if(!binding || binding->differs(texture)) {
+            glBindTexture(target, texture);
+            if(binding) {
+                binding->set(texture);
+            }
+        }
+    }
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+        Rect rect = { x, y, width, height };
+        if(m_Viewport.differs(rect)) {
+            glViewport(x, y, width, height);
+            m_Viewport.set(rect);
+        }
+    }
+
+    void scissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+        Rect rect = { x, y, width, height };
+        if(m_Scissor.differs(rect)) {
+            glScissor(x, y, width, height);
+            m_Scissor.set(rect);
+        }
+    }
+
+    void lineWidth(GLfloat width) {
+        if(m_LineWidth.differs(width)) {
+            glLineWidth(width);
+            m_LineWidth.set(width);
+        }
+    }
+
+    void primitiveRestartIndex(GLuint index) {
+        if(m_RestartIndex.differs(index)) {
+            glPrimitiveRestartIndex(index);
+            m_RestartIndex.set(index);
+        }
+    }
+
+    // Deleting a bound object unbinds it, and its name may be given again to a new one
+    void deleteProgram(GLuint program) {
+        if(m_Program.valid && m_Program.value == program) {
+            useProgram(0);
+        }
+        glDeleteProgram(program);
+    }
+
+    void deleteVertexArray(GLuint vertexArray) {
+        glDeleteVertexArrays(1, &vertexArray);
+        if(m_VertexArray.valid && m_VertexArray.value == vertexArray) {
+            m_VertexArray.set(0);
+        }
+    }
+
+    void deleteTexture(GLuint texture) {
+        glDeleteTextures(1, &texture);
+        for(GLuint unit = 0; unit < TEXTURE_UNIT_COUNT; ++unit) {
+            if(m_Textures2D[unit].valid && m_Textures2D[unit].value == texture) {
+                m_Textures2D[unit].set(0);
+            }
+            if(m_TextureBuffers[unit].valid && m_TextureBuffers[unit].value == texture) {
+                m_TextureBuffers[unit].set(0);
+            }
+        }
+    }
+
+private:
+    static GLenum capabilityEnum(Capability cap) {
+        static const GLenum CAPABILITY_ENUMS[CAPABILITY_COUNT] = {
+            GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST, GL_LINE_SMOOTH, GL_PRIMITIVE_RESTART
+        };
+        return CAPABILITY_ENUMS[cap];
+    }
+
+    template<typename T>
+    struct Cached {
+        T value;
+        bool valid;
+
+        bool differs(const T& other) const {
+            return !valid || !(value == other);
+        }
+
+        void set(const T& other) {
+            value = other;
+            valid = true;
+        }
+    };
+
+    // Null if the target or the active unit is not tracked
+    Cached<GLuint>* textureBinding(GLenum target) {
+        if(!m_ActiveTexture.valid || m_ActiveTexture.value - GL_TEXTURE0 >= TEXTURE_UNIT_COUNT) {
+            return nullptr;
+        }
+        GLuint unit = m_ActiveTexture.value - GL_TEXTURE0;
+        return target == GL_TEXTURE_2D ? &m_Textures2D[unit] :
+               target == GL_TEXTURE_BUFFER ? &m_TextureBuffers[unit] : nullptr;
+    }
+
+    Cached<bool> m_Capabilities[CAPABILITY_COUNT];
+    Cached<GLuint> m_Program, m_VertexArray;
+    Cached<GLenum> m_PolygonMode;
+    Cached<GLenum> m_BlendFunc[2]; // Source and destination factors
+    Cached<GLenum> m_ActiveTexture;
+    Cached<GLuint> m_Textures2D[TEXTURE_UNIT_COUNT], m_TextureBuffers[TEXTURE_UNIT_COUNT];
+    Cached<Rect> m_Viewport, m_Scissor;
+    Cached<GLfloat> m_LineWidth;
+    Cached<GLuint> m_RestartIndex;
+};
+
+}
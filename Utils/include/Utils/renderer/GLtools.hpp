@@ -8,4 +8,8 @@ namespace Utils {
 
 GLuint buildProgram(const GLchar* vertexShaderSrc, const GLchar* fragmentShaderSrc);
 
+// Linked programs are stored there as driver binaries, keyed by their sources and the
+// driver, so that later launches skip compilation. Null (the default) disables the cache.
+void setProgramCacheDirectory(const char* directory);
+
 }
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace Utils {
+
+// Index buffer of a row-major grid as one triangle strip per row of quads, separated by the
+// primitive restart index (the largest Index). The strip of the row j goes through (0, j + 1),
+// (0, j), (1, j + 1), (1, j)... Its triangle p is ACD of the quad p / 2 when p is even and ABC
+// when p is odd, with the diagonal and the winding of Flag's triangle numbering.
+// A strip ends before each torn triangle and starts again after it. A strip starting on an odd
+// triangle repeats its first vertex, since GL counts the parity of each strip from its start.
+//
+// With a step, only every step-th row and column is drawn, plus the last ones. A coarse
+// quad is left out as soon as one of the triangles it covers is torn.
+
+// Rows of quads drawn with a step
+inline int gridStripRowCount(int gridHeight, int step = 1) {
+    return (gridHeight - 2) / step + 1;
+}
+
+// Coarse row covering the quads of the grid row j
+inline int gridStripRow(int j, int step = 1) {
+    return j / step;
+}
+
+// Most indices the strips of one row can take, reached when every other triangle is torn:
+// each strip of n triangles takes n + 2 vertices, a restart, and one more vertex at most
+inline int gridStripRowCapacity(int gridWidth, int step = 1) {
+    const int triangleCount = 2 * ((gridWidth - 2) / step + 1);
+    return triangleCount + 4 * ((triangleCount + 1) / 2);
+}
+
+// Append the strips of the coarse row r to indexBuffer
+template<typename Index>
+void buildGridStripRow(int gridWidth, int gridHeight, const std::vector<bool>& tornTriangleArray,
+                       int r, std::vector<Index>& indexBuffer, int step = 1) {
+    const Index restartIndex = std::numeric_limits<Index>::max();
+    const int columnCount = (gridWidth - 2) / step + 2;
+    const int triangleCount = 2 * (columnCount - 1);
+
+    // Grid coordinate of a coarse row or column
+    auto column = [&](int c) {
+        return std::min(c * step, gridWidth - 1);
+    };
+    auto row = [&](int r) {
+        return std::min(r * step, gridHeight - 1);
+    };
+
+    auto stripVertex = [&](int p) {
+        return Index(column(p / 2) + row(r + 1 - p % 2) * gridWidth);
+    };
+    auto torn = [&](int p) {
+        if(tornTriangleArray.empty()) {
+            return false;
+        }
+        if(step == 1) {
+            return bool(tornTriangleArray[2 * (p / 2 + r * (gridWidth - 1)) + 1 - p % 2]);
+        }
+        for(int j = row(r); j < row(r + 1); ++j) {
+            for(int i = column(p / 2); i < column(p / 2 + 1); ++i) {
+                if(tornTriangleArray[2 * (i + j * (gridWidth - 1))] || tornTriangleArray[2 * (i + j * (gridWidth - 1)) + 1]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+
+    for(int p = 0, end; p < triangleCount; p = end) {
+        if(torn(p)) {
+            end = p + 1;
+            continue;
+        }
+
+        for(end = p + 1; end < triangleCount && !torn(end); ++end);
+        if(p % 2) {
+            indexBuffer.push_back(stripVertex(p));
+        }
+        for(int q = p; q < end + 2; ++q) {
+            indexBuffer.push_back(stripVertex(q));
+        }
+        indexBuffer.push_back(restartIndex);
+    }
+}
+
+// Append the strips of every row to indexBuffer
+template<typename Index>
+void buildGridStrips(int gridWidth, int gridHeight, const std::vector<bool>& tornTriangleArray,
+                     std::vector<Index>& indexBuffer, int step = 1) {
+    const int rowCount = gridStripRowCount(gridHeight, step);
+    indexBuffer.reserve(indexBuffer.size() + (2 * ((gridWidth - 2) / step + 2) + 1) * rowCount);
+
+    for(int r = 0; r < rowCount; ++r) {
+        buildGridStripRow(gridWidth, gridHeight, tornTriangleArray, r, indexBuffer, step);
+    }
+}
+
+}
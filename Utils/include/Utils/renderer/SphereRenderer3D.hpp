@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Utils/glm.hpp"
+#include "Utils/Flag.h"
+#include <GL/glew.h>
+#include <vector>
+
+namespace Utils {
+
+// Sphere colliders drawn with a single instanced call of a shared icosphere. The spheres
+// are uploaded as they are laid out in memory, each one being an instance of center and radius.
+class SphereRenderer3D {
+public:
+    // The icosphere has 20 * 4^subdivisionCount triangles, its vertices being on the sphere
+    explicit SphereRenderer3D(uint subdivisionCount = 1);
+
+    ~SphereRenderer3D();
+
+    SphereRenderer3D(const SphereRenderer3D&) = delete;
+
+    SphereRenderer3D& operator =(const SphereRenderer3D&) = delete;
+
+    void drawSpheres(const std::vector<Sphere>& spheres, bool wireframe);
+
+    void setProjMatrix(const glm::mat4& P) {
+        m_bMatricesDirty |= P != m_ProjMatrix;
+        m_ProjMatrix = P;
+    }
+
+    void setViewMatrix(const glm::mat4& V) {
+        m_bMatricesDirty |= V != m_ViewMatrix;
+        m_ViewMatrix = V;
+    }
+
+private:
+    static const GLchar *VERTEX_SHADER, *FRAGMENT_SHADER;
+
+    // OpenGL
+    GLuint m_ProgramID;
+    GLuint m_VBOID, m_IBOID, m_InstanceBufferID, m_VAOID;
+
+    GLint m_uMVPMatrix, m_uMVMatrix;
+
+    glm::mat4 m_ProjMatrix;
+    glm::mat4 m_ViewMatrix;
+    bool m_bMatricesDirty; // Not uploaded since they changed
+
+    uint32_t m_nIndexCount;
+    size_t m_nInstanceCapacity; // In spheres
+};
+
+}
@@ -15,6 +15,10 @@ public:
 		m_fDistance = glm::max(0.1f, m_fDistance);
 	}
 
+	float getDistance() const {
+		return m_fDistance;
+	}
+
 	void rotateLeft(float degrees) {
 		m_fAngleY += degrees;
 	}
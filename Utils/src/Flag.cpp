@@ -1,32 +1,56 @@
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include "Utils/Flag.h"
+#include "Utils/FlagGrid.hpp"
+#include "Utils/Parallel.hpp"
 
+// Steps under the sleep threshold before a tile falls asleep
+static const uint SLEEP_STEP_COUNT = 30;
 
-inline glm::vec3 hookForce(float K, float L, const glm::vec3 &P1, const glm::vec3 &P2) {
-    static const float epsilon = 0.0001;
 
-    glm::vec3 F = K * (1 - L / glm::max(glm::distance(P1, P2), epsilon)) * (P2 - P1);
+template<typename Real>
+inline glm::detail::tvec3<Real, glm::defaultp> hookForce(Real K, Real L,
+                                                         const glm::detail::tvec3<Real, glm::defaultp> &P1,
+                                                         const glm::detail::tvec3<Real, glm::defaultp> &P2) {
+    static const Real epsilon = 0.0001;
+
+    glm::detail::tvec3<Real, glm::defaultp> F = K * (1 - L / glm::max(glm::distance(P1, P2), epsilon)) * (P2 - P1);
     return F;
 }
 
-inline glm::vec3 brakeForce(float V, float dt, const glm::vec3 &v1, const glm::vec3 &v2) {
-    glm::vec3 F = V * (v2 - v1) / dt;
+template<typename Real>
+inline glm::detail::tvec3<Real, glm::defaultp> brakeForce(Real V, Real dt,
+                                                          const glm::detail::tvec3<Real, glm::defaultp> &v1,
+                                                          const glm::detail::tvec3<Real, glm::defaultp> &v2) {
+    glm::detail::tvec3<Real, glm::defaultp> F = V * (v2 - v1) / dt;
     return F;
 }
 
-Flag::Flag(float mass, float width, float height, uint gridWidth, uint gridHeight) :
+template<typename Real, typename Storage>
+BasicFlag<Real, Storage>::BasicFlag(Real mass, Real width, Real height, uint gridWidth, uint gridHeight, FlagLayout layout) :
         gridWidth(gridWidth), gridHeight(gridHeight),
+        layout(gridWidth % TILE_SIZE || gridHeight % TILE_SIZE ? ROW_MAJOR : layout),
         positionArray(gridWidth * gridHeight),
-        velocityArray(gridWidth * gridHeight, glm::vec3(0.f)),
+        velocityArray(gridWidth * gridHeight, vec3(0.f)),
         massArray(gridWidth * gridHeight, mass / (gridWidth * gridHeight)),
-        forceArray(gridWidth * gridHeight, glm::vec3(0.f)){
-    glm::vec3 origin(-0.5f * width, -0.5f * height, 0.f);
-    glm::vec3 scale(width / (gridWidth - 1), height / (gridHeight - 1), 1.f);
+        forceArray(gridWidth * gridHeight, vec3(0.f)),
+        materialArray(1),
+        materialIndexArray(gridWidth * gridHeight, 0){
+    vec3 origin(Real(-0.5) * width, Real(-0.5) * height, 0.f);
+    vec3 scale(width / (gridWidth - 1), height / (gridHeight - 1), 1.f);
+
+    tearStrain = 0;
+    dragCoefficient = liftCoefficient = 0;
+    sleepThreshold = 0;
+    externalForce = lastExternalForce = glm::vec3(0.f);
+    colliderCount = 0;
+    wakeAll();
 
     for (int j = 0; j < gridHeight; ++j) {
         for (int i = 0; i < gridWidth; ++i) {
-            int k = i + j * gridWidth;
-            positionArray[k] = origin + glm::vec3(i, j, origin.z) * scale;
+            int k = index(i, j);
+            positionArray[k] = origin + vec3(i, j, origin.z) * scale;
         }
     }
 
@@ -34,7 +58,7 @@ Flag::Flag(float mass, float width, float height, uint gridWidth, uint gridHeigh
     L0.x = scale.x;
     L0.y = scale.y;
     L1 = glm::length(L0);
-    L2 = 2.f * L0;
+    L2 = Real(2) * L0;
 
     K0 = 25.0;
     K1 = 1.3;
@@ -45,200 +69,627 @@ Flag::Flag(float mass, float width, float height, uint gridWidth, uint gridHeigh
     V2 = 0.06;
 }
 
-void Flag::applyInternalForces(float dt) {
-
-    uint i,j,k;
-    glm::vec3 horizontalForces, verticalForces;
-    glm::vec3 rightCrossForces, leftCrossForces;
+template<typename Real, typename Storage>
+const uint BasicFlag<Real, Storage>::TILE_SIZE;
 
-    // Topology 0 : Direct Link
+template<typename Real, typename Storage>
+uint BasicFlag<Real, Storage>::addMaterial(Real K0, Real K1, Real K2, Real V0, Real V1, Real V2) {
+    SpringMaterial<Real> material = { { K0, K1, K2 }, { V0, V1, V2 } };
+    materialArray.push_back(material);
+    return materialArray.size() - 1;
+}
 
-        for(j = 0; j < gridHeight-1; ++j) {
-            for(i = 0; i < gridWidth-1; ++i) {
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::setMaterial(uint i0, uint j0, uint i1, uint j1, uint material) {
+    for (uint j = j0; j < std::min(j1, gridHeight); ++j)
+        for (uint i = i0; i < std::min(i1, gridWidth); ++i)
+            materialIndexArray[index(i, j)] = material;
+}
 
-                k = i + j * gridWidth;
+template<typename Real, typename Storage>
+Real BasicFlag<Real, Storage>::maxStiffness() const {
+    Real stiffness = K0 + K1 + K2;
+    for (size_t m = 1; m < materialArray.size(); ++m)
+        stiffness = std::max(stiffness, materialArray[m].K[0] + materialArray[m].K[1] + materialArray[m].K[2]);
+    return stiffness;
+}
 
-                horizontalForces = hookForce(K0, L0.x, positionArray[k], positionArray[k + 1]) +
-                                   brakeForce(V0, dt, velocityArray[k], velocityArray[k + 1]);
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::tearSpring(uint i, uint j, SpringDirection direction) {
+    if (springMaskArray.empty())
+        springMaskArray.assign(gridWidth * gridHeight, (1 << SPRING_DIRECTION_COUNT) - 1);
+
+    uint8_t &mask = springMaskArray[index(i, j)];
+    if (!(mask & (1 << direction)))
+        return;
+    mask &= ~(1 << direction);
+
+    // Quad (i, j) is split into (i, j) (i + 1, j) (i + 1, j + 1) and (i, j) (i + 1, j + 1) (i, j + 1)
+    const uint quadCountX = gridWidth - 1;
+    const size_t tornCount = tornTriangleArray.size();
+    switch (direction) {
+    case SPRING_RIGHT:
+        if (j + 1 < gridHeight)
+            tornTriangleArray.push_back(2 * (i + j * quadCountX));
+        if (j > 0)
+            tornTriangleArray.push_back(2 * (i + (j - 1) * quadCountX) + 1);
+        break;
+    case SPRING_DOWN:
+        if (i + 1 < gridWidth)
+            tornTriangleArray.push_back(2 * (i + j * quadCountX) + 1);
+        if (i > 0)
+            tornTriangleArray.push_back(2 * (i - 1 + j * quadCountX));
+        break;
+    case SPRING_DOWN_RIGHT:
+        tornTriangleArray.push_back(2 * (i + j * quadCountX));
+        tornTriangleArray.push_back(2 * (i + j * quadCountX) + 1);
+        break;
+    case SPRING_DOWN_LEFT:
+        tornTriangleArray.push_back(2 * (i - 1 + j * quadCountX));
+        tornTriangleArray.push_back(2 * (i - 1 + j * quadCountX) + 1);
+        break;
+    default:
+        // 2-step links only resist bending, they are not triangle edges
+        break;
+    }
 
-                verticalForces   = hookForce(K0, L0.y, positionArray[k], positionArray[k + gridWidth]) +
-                                   brakeForce(V0, dt, velocityArray[k], velocityArray[k + gridWidth]);
+    // Torn triangles catch no more air
+    if (tornTriangleArray.size() > tornCount && faceTornArray.empty())
+        faceTornArray.assign(2 * quadCountX * (gridHeight - 1), 0);
+    for (size_t t = tornCount; t < tornTriangleArray.size(); ++t)
+        faceTornArray[tornTriangleArray[t]] = 1;
+}
 
-                if(i>0){
-                    forceArray[k]           += horizontalForces + verticalForces;
-                    forceArray[k+gridWidth] -= verticalForces;
-                }
+template<typename Real, typename Storage>
+const typename BasicFlag<Real, Storage>::vec3* BasicFlag<Real, Storage>::rowMajorPositions() {
+    if (layout == ROW_MAJOR)
+        return positionArray.data();
 
-                forceArray[k+1] -= horizontalForces;
-            }
-        }
+    // Copy tile rows, each one contiguous on both sides
+    rowMajorPositionArray.resize(positionArray.size());
+    for (uint j = 0; j < gridHeight; ++j)
+        for (uint i = 0; i < gridWidth; i += TILE_SIZE)
+            std::copy_n(&positionArray[index(i, j)], TILE_SIZE, &rowMajorPositionArray[i + j * gridWidth]);
 
-        // Last Column
-        for(j = 0; j < gridHeight-1; ++j) {
+    return rowMajorPositionArray.data();
+}
 
-            k = j + (j+1) * (gridWidth-1);
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::wakeAll() {
+    tileCountX = (gridWidth + TILE_SIZE - 1) / TILE_SIZE;
+    tileCountY = (gridHeight + TILE_SIZE - 1) / TILE_SIZE;
 
-            verticalForces = hookForce(K0, L0.y, positionArray[k], positionArray[k + gridWidth]) +
-                             brakeForce(V0, dt, velocityArray[k], velocityArray[k + gridWidth]);
+    tileSleepingArray.assign(tileCountX * tileCountY, 0);
+    tileQuietStepArray.assign(tileCountX * tileCountY, 0);
+    tileActiveArray.assign(tileCountX * tileCountY, 1);
+    tileWakeArray.clear();
+    tileFieldChangeArray.assign(tileCountX * tileCountY, 0);
+    sleepingTileCount = 0;
 
-            forceArray[k]             += verticalForces;
-            forceArray[k + gridWidth] -= verticalForces;
-        }
+    // Sleeping tiles did not keep their forces up to date
+    std::fill(forceArray.begin(), forceArray.end(), vec3(0.f));
+}
 
-        // Last line
-        for(i = 0; i < gridWidth-1; ++i){
+// Spring of a topology between vertices k and n : F is applied to k and -F to n.
+// Stiffness and damping come from the material of k, looked up without branching.
+template<typename Flag, typename Real>
+inline void applySpring(Flag &flag, uint k, uint n, int topology, Real L, Real dt) {
+    typedef typename Flag::vec3 vec3;
 
-            k = i + (gridWidth) * (gridHeight-1);
+    const SpringMaterial<Real> &material = flag.materialArray[flag.materialIndexArray[k]];
 
-            horizontalForces = hookForce(K0, L0.x, positionArray[k], positionArray[k + 1]) +
-                               brakeForce(V0, dt, velocityArray[k], velocityArray[k + 1]);
+    vec3 F = hookForce(material.K[topology], L, flag.positionArray[k], flag.positionArray[n]) +
+             brakeForce(material.V[topology], dt, vec3(flag.velocityArray[k]), vec3(flag.velocityArray[n]));
 
-            if(i>0)
-                forceArray[k] += horizontalForces;
+    flag.forceArray[k] += F;
+    flag.forceArray[n] -= F;
+}
 
-            forceArray[k+1] -= horizontalForces;
-        }
+// With tearing, false once the spring from (i, j) to n is broken: it breaks here when its
+// squared length exceeds maxLength2. Without tearing the test is compiled out.
+template<bool Tearing, typename Flag, typename Real>
+inline bool springIntact(Flag &flag, uint k, uint n, uint i, uint j, SpringDirection direction, Real maxLength2) {
+    if(!Tearing)
+        return true;
+    if(!(flag.springMaskArray[k] & (1 << direction)))
+        return false;
+
+    typename Flag::vec3 d = flag.positionArray[n] - flag.positionArray[k];
+    if(glm::dot(d, d) <= maxLength2)
+        return true;
+
+    flag.tearSpring(i, j, direction);
+    return false;
+}
 
-    // Topology 1 : Cross link
+// Springs starting on row j between columns i0 and i1, each spring being evaluated
+// once from its top/left end. Fixed points receive forces too, update() discards them.
+template<bool Tearing, typename Grid, typename Flag, typename Real>
+static inline void springRow(const Grid &grid, Flag &flag, uint j, uint i0, uint i1, Real dt) {
+    const uint w = grid.width(), h = grid.height();
 
-        for(j = 0; j < gridHeight-1; ++j) {
-            for(i = 0; i < gridWidth-1; ++i) {
+    // Squared breaking length relative to the squared rest length, never reached when tearing is off
+    const Real stretch2 = flag.tearStrain > 0 ? (1 + flag.tearStrain) * (1 + flag.tearStrain) : std::numeric_limits<Real>::max();
+    const Real max0x = stretch2 * flag.L0.x * flag.L0.x, max0y = stretch2 * flag.L0.y * flag.L0.y;
+    const Real max1 = stretch2 * flag.L1 * flag.L1;
+    const Real max2x = stretch2 * flag.L2.x * flag.L2.x, max2y = stretch2 * flag.L2.y * flag.L2.y;
 
-                k = i + j * gridWidth;
+    // Topology 0 : Direct Link
+    for(uint i = i0; i < std::min(i1, w - 1); ++i) {
+        uint k = grid.index(i, j), n = grid.index(i + 1, j);
+        if(springIntact<Tearing>(flag, k, n, i, j, SPRING_RIGHT, max0x))
+            applySpring(flag, k, n, 0, flag.L0.x, dt);
+    }
 
-                rightCrossForces = hookForce(K1, L1, positionArray[k], positionArray[k + gridWidth + 1]) +
-                                   brakeForce(V1, dt, velocityArray[k], velocityArray[k + gridWidth + 1]);
+    if(j + 1 < h) {
+        for(uint i = i0; i < i1; ++i) {
+            uint k = grid.index(i, j), n = grid.index(i, j + 1);
+            if(springIntact<Tearing>(flag, k, n, i, j, SPRING_DOWN, max0y))
+                applySpring(flag, k, n, 0, flag.L0.y, dt);
+        }
 
-                leftCrossForces  = hookForce(K1, L1, positionArray[k], positionArray[k + gridWidth - 1]) +
-                                   brakeForce(V1, dt, velocityArray[k], velocityArray[k + gridWidth - 1]);
+    // Topology 1 : Cross link
+        for(uint i = i0; i < std::min(i1, w - 1); ++i) {
+            uint k = grid.index(i, j), n = grid.index(i + 1, j + 1);
+            if(springIntact<Tearing>(flag, k, n, i, j, SPRING_DOWN_RIGHT, max1))
+                applySpring(flag, k, n, 1, flag.L1, dt);
+        }
 
-                if(i>0){
-                    forceArray[k] += rightCrossForces + leftCrossForces;
-                }
+        for(uint i = std::max(i0, 1u); i < i1; ++i) {
+            uint k = grid.index(i, j), n = grid.index(i - 1, j + 1);
+            if(springIntact<Tearing>(flag, k, n, i, j, SPRING_DOWN_LEFT, max1))
+                applySpring(flag, k, n, 1, flag.L1, dt);
+        }
+    }
 
-                if(i>1){
-                    forceArray[k-1+gridWidth] -= leftCrossForces;
-                }
+    // Topology 2 : 2-step link
+    for(uint i = i0; i < std::min(i1, w - 2); ++i) {
+        uint k = grid.index(i, j), n = grid.index(i + 2, j);
+        if(springIntact<Tearing>(flag, k, n, i, j, SPRING_RIGHT2, max2x))
+            applySpring(flag, k, n, 2, flag.L2.x, dt);
+    }
 
-                forceArray[k+1+gridWidth] -= rightCrossForces;
-            }
+    if(j + 2 < h) {
+        for(uint i = i0; i < i1; ++i) {
+            uint k = grid.index(i, j), n = grid.index(i, j + 2);
+            if(springIntact<Tearing>(flag, k, n, i, j, SPRING_DOWN2, max2y))
+                applySpring(flag, k, n, 2, flag.L2.y, dt);
         }
+    }
+}
 
-        // Last column
-        for(j = 0; j < gridHeight-1; ++j) {
+// Internal forces of the whole grid by bands of tile rows, skipping the springs between
+// sleeping tiles. The tiled layout is walked tile by tile to stay in cache, the row-major
+// layout row by row over consecutive active tiles.
+template<bool Tearing, typename Grid, typename Flag, typename Real>
+static void springForces(const Grid &grid, Flag &flag, Real dt) {
+    const uint w = grid.width(), h = grid.height();
+    const uint T = Flag::TILE_SIZE;
+
+    // Nothing asleep: whole rows, whose bounds are compile time constants with StaticGrid
+    if(!flag.sleepingTileCount && flag.layout == ROW_MAJOR) {
+        for(uint j = 0; j < h; ++j)
+            springRow<Tearing>(grid, flag, j, 0, w, dt);
+        return;
+    }
 
-            k = j + (j+1) * (gridWidth-1);
+    for(uint tj = 0; tj < flag.tileCountY; ++tj) {
+        const uint j0 = tj * T, j1 = std::min(j0 + T, h);
+        const uint8_t *active = &flag.tileActiveArray[tj * flag.tileCountX];
 
-            leftCrossForces = hookForce(K1, L1, positionArray[k], positionArray[k + gridWidth - 1]) +
-                              brakeForce(V1, dt, velocityArray[k], velocityArray[k + gridWidth - 1]);
+        for(uint ti = 0; ti < flag.tileCountX; ) {
+            if(flag.sleepingTileCount && !active[ti]) {
+                ++ti;
+                continue;
+            }
 
-            forceArray[k]             += leftCrossForces;
-            forceArray[k-1+gridWidth] -= leftCrossForces;
-        }
+            uint begin = ti++;
+            if(flag.layout == ROW_MAJOR) {
+                while(ti < flag.tileCountX && (!flag.sleepingTileCount || active[ti]))
+                    ++ti;
+            }
 
-    // Topology 2 : 2-step link
+            for(uint j = j0; j < j1; ++j)
+                springRow<Tearing>(grid, flag, j, begin * T, std::min(ti * T, w), dt);
+        }
+    }
+}
 
-        for(j = 0; j < gridHeight-2; ++j) {
-            for(i = 0; i < gridWidth-2; ++i) {
+// Common sizes get a kernel specialised at compile time
+template<bool Tearing, typename Flag, typename Real>
+static void dispatchSpringForces(Flag &flag, Real dt) {
+    const uint w = flag.gridWidth, h = flag.gridHeight;
+
+    if(flag.layout == TILED)
+        springForces<Tearing>(TiledGrid<Flag::TILE_SIZE>(w, h), flag, dt);
+    else if(w == 32 && h == 16)
+        springForces<Tearing>(StaticGrid<32, 16>(), flag, dt);
+    else if(w == 64 && h == 32)
+        springForces<Tearing>(StaticGrid<64, 32>(), flag, dt);
+    else if(w == 128 && h == 64)
+        springForces<Tearing>(StaticGrid<128, 64>(), flag, dt);
+    else
+        springForces<Tearing>(DynamicGrid(w, h), flag, dt);
+}
 
-                k = i + j * gridWidth;
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::applyInternalForces(Real dt) {
+    SpringMaterial<Real> defaultMaterial = { { K0, K1, K2 }, { V0, V1, V2 } };
+    materialArray[0] = defaultMaterial;
+
+    // Springs reach the right, bottom left and bottom right tiles
+    if(sleepingTileCount) {
+        for(int tj = 0; tj < tileCountY; ++tj) {
+            for(int ti = 0; ti < tileCountX; ++ti) {
+                tileActiveArray[ti + tj * tileCountX] =
+                        isTileAwake(ti, tj) || isTileAwake(ti + 1, tj) ||
+                        isTileAwake(ti - 1, tj + 1) || isTileAwake(ti, tj + 1) || isTileAwake(ti + 1, tj + 1);
+            }
+        }
+    }
 
-                horizontalForces = hookForce(K2, L2.x, positionArray[k], positionArray[k + 2]) +
-                                   brakeForce(V2, dt, velocityArray[k], velocityArray[k + 2]);
+    // Flags that never tear keep the kernel without mask
+    if(tearStrain > 0 && springMaskArray.empty())
+        springMaskArray.assign(gridWidth * gridHeight, (1 << SPRING_DIRECTION_COUNT) - 1);
 
-                verticalForces   = hookForce(K2, L2.y, positionArray[k], positionArray[k + 2 * gridWidth]) +
-                                   brakeForce(V2, dt, velocityArray[k], velocityArray[k + 2 * gridWidth]);
+    if(springMaskArray.empty())
+        dispatchSpringForces<false>(*this, dt);
+    else
+        dispatchSpringForces<true>(*this, dt);
+}
 
-                if(i>0){
-                    forceArray[k]             += horizontalForces + verticalForces;
-                    forceArray[k+2*gridWidth] -= verticalForces;
-                }
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::applyExternalForce(const glm::vec3 &F) {
+    externalForce += F;
 
-                forceArray[k+2] -= horizontalForces;
+    uint k;
+    for (int j = 0; j < gridHeight; ++j) {
+        for (int i = 1; i < gridWidth; ++i) {
+            k = index(i, j);
+            if (sleepingTileCount && tileSleepingArray[tileIndex(i, j)]) {
+                // Skip to the next tile
+                i = (i / TILE_SIZE + 1) * TILE_SIZE - 1;
+                continue;
             }
+            forceArray[k] += vec3(F);
         }
+    }
+}
 
-        // Last columns
-        for(j = 0; j < gridHeight-2; ++j) {
-
-            k = j + (j+1) * (gridWidth-1);
-
-            verticalForces = hookForce(K2, L2.y, positionArray[k], positionArray[k + 2 * gridWidth]) +
-                             brakeForce(V2, dt, velocityArray[k], velocityArray[k + 2 * gridWidth]);
+// Positions in the precision of the normal stage
+static const glm::vec3* floatPositions(const glm::vec3 *positionArray, size_t, std::vector<glm::vec3> &) {
+    return positionArray;
+}
 
-            forceArray[k]             += verticalForces;
-            forceArray[k+2*gridWidth] -= verticalForces;
+static const glm::vec3* floatPositions(const glm::dvec3 *positionArray, size_t count, std::vector<glm::vec3> &floatArray) {
+    floatArray.assign(positionArray, positionArray + count);
+    return floatArray.data();
+}
 
-            verticalForces = hookForce(K2, L2.y, positionArray[k - 1], positionArray[k + 2 * gridWidth - 1]) +
-                             brakeForce(V2, dt, velocityArray[k - 1], velocityArray[k + 2 * gridWidth - 1]);
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::computeNormals() {
+    std::vector<glm::vec3> floatArray;
+    normals.computeFaceNormals(floatPositions(rowMajorPositions(), positionArray.size(), floatArray), gridWidth, gridHeight);
+}
 
-            forceArray[k-1]             += verticalForces;
-            forceArray[k+2*gridWidth-1] -= verticalForces;
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::applyAerodynamicForces(const glm::vec3 &wind, const glm::vec3 *windArray) {
+    externalForce += wind;
+    computeNormals();
+
+    const int quadCountX = gridWidth - 1, quadCountY = gridHeight - 1;
+    const std::vector<glm::vec3> &faceNormalArray = normals.getFaceNormals();
+    faceForceArray.resize(faceNormalArray.size());
+
+    // Air velocity relative to each vertex, in row-major order
+    relativeVelocityArray.resize(gridWidth * gridHeight);
+    #pragma omp parallel for if(gridWidth * gridHeight >= PARALLEL_VERTEX_COUNT)
+    for (int j = 0; j < int(gridHeight); ++j) {
+        for (int i = 0; i < int(gridWidth); ++i) {
+            uint k = index(i, j);
+            vec3 air = windArray ? vec3(wind + windArray[k]) : vec3(wind);
+            relativeVelocityArray[i + j * gridWidth] = air - vec3(velocityArray[k]);
         }
+    }
 
-        // Last lines
-        for(i = 0; i < gridWidth-2; ++i){
+    // Force of each triangle, a third of it for each of its vertices
+    #pragma omp parallel for if(gridWidth * gridHeight >= PARALLEL_VERTEX_COUNT)
+    for (int j = 0; j < quadCountY; ++j) {
+        const vec3 *row = &relativeVelocityArray[j * gridWidth], *nextRow = row + gridWidth;
 
-            k = i + (gridWidth) * (gridHeight-1);
+        for (int i = 0; i < quadCountX; ++i) {
+            for (int t = 0; t < 2; ++t) {
+                uint f = 2 * (i + j * quadCountX) + t;
 
-            horizontalForces = hookForce(K2, L2.x, positionArray[k], positionArray[k + 2]) +
-                               brakeForce(V2, dt, velocityArray[k], velocityArray[k + 2]);
+                // Mean over the triangle, against the normal N = 2 * area * n
+                vec3 v = (row[i] + nextRow[i + 1] + (t ? nextRow[i] : row[i + 1])) / Real(3);
+                vec3 N(faceNormalArray[f]);
+                Real speed2 = glm::dot(v, v), N2 = glm::dot(N, N), Nv = glm::dot(N, v);
 
-            if(i>0){
-                forceArray[k]   += horizontalForces;
-                forceArray[k+2] -= horizontalForces;
-            }
+                if (speed2 < Real(1e-12) || N2 < Real(1e-12) || (!faceTornArray.empty() && faceTornArray[f])) {
+                    faceForceArray[f] = vec3(0.f);
+                    continue;
+                }
 
-            horizontalForces = hookForce(K2, L2.x, positionArray[k - gridWidth], positionArray[k + 2 - gridWidth]) +
-                               brakeForce(V2, dt, velocityArray[k - gridWidth], velocityArray[k + 2 - gridWidth]);
-            if(i>0){
-                forceArray[k-gridWidth]   += horizontalForces;
-                forceArray[k+2-gridWidth] -= horizontalForces;
+                // Drag : area facing the air times speed^2, along v.
+                // Lift : area times speed^2 times cos * sin of the angle of attack, across v.
+                Real invNSpeed = Real(1) / glm::sqrt(N2 * speed2);
+                vec3 drag = dragCoefficient * glm::abs(Nv) * v;
+                vec3 lift = liftCoefficient * Nv * invNSpeed * (N * speed2 - v * Nv);
+                faceForceArray[f] = (drag + lift) / Real(6);
             }
         }
+    }
+
+    // Gather the six triangles around each vertex, no two threads writing the same vertex
+    #pragma omp parallel for if(gridWidth * gridHeight >= PARALLEL_VERTEX_COUNT)
+    for (int j = 0; j < int(gridHeight); ++j) {
+        for (int i = 1; i < int(gridWidth); ++i) {
+            if (sleepingTileCount && tileSleepingArray[tileIndex(i, j)])
+                continue;
+
+            vec3 F(0.f);
+            if (i < quadCountX && j < quadCountY)
+                F += faceForceArray[2 * (i + j * quadCountX)] + faceForceArray[2 * (i + j * quadCountX) + 1];
+            if (j < quadCountY)
+                F += faceForceArray[2 * (i - 1 + j * quadCountX)];
+            if (j > 0)
+                F += faceForceArray[2 * (i - 1 + (j - 1) * quadCountX)] + faceForceArray[2 * (i - 1 + (j - 1) * quadCountX) + 1];
+            if (i < quadCountX && j > 0)
+                F += faceForceArray[2 * (i + (j - 1) * quadCountX) + 1];
+            forceArray[index(i, j)] += F;
+        }
+    }
 }
 
-void Flag::applyExternalForce(const glm::vec3 &F) {
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::applyExternalForces(const glm::vec3 *F) {
+    if (fieldForceArray.size() != positionArray.size())
+        fieldForceArray.assign(F, F + positionArray.size());
+
     uint k;
     for (int j = 0; j < gridHeight; ++j) {
-        for (int i = 0; i < gridWidth; ++i) {
-            k = i + j * gridWidth;
-            if (i != 0)
-                forceArray[k] += F;
+        for (int i = 1; i < gridWidth; ++i) {
+            k = index(i, j);
+            // Unlike a change of wind, a changing field only wakes the tiles it changed on, see update()
+            if (sleepingTileCount && tileSleepingArray[tileIndex(i, j)]) {
+                Real &change = tileFieldChangeArray[tileIndex(i, j)];
+                vec3 acceleration = (vec3(F[k]) - fieldForceArray[k]) / Real(massArray[k]);
+                change = std::max(change, glm::dot(acceleration, acceleration));
+                continue;
+            }
+            fieldForceArray[k] = F[k];
+            forceArray[k] += vec3(F[k]);
         }
     }
 }
 
-void Flag::sphereCollision(const Sphere &sphere, float dt){
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::sphereCollision(const Sphere &sphere, Real dt){
+    vec3 center(sphere.center);
+
+    // A collider that moved since the previous step wakes the tiles it touches or touched
+    bool moved = false;
+    Sphere previous = sphere;
+    if (colliderCount < colliderArray.size()) {
+        previous = colliderArray[colliderCount];
+        moved = previous.center != sphere.center || previous.radius != sphere.radius;
+        colliderArray[colliderCount] = sphere;
+    } else {
+        colliderArray.push_back(sphere);
+    }
+    ++colliderCount;
+
     for(int j = 0; j < gridHeight; ++j) {
         for(int i = 0; i < gridWidth; ++i) {
-            int k = i + j * gridWidth;
+            int k = index(i, j);
 
-            float rad = sphere.radius + 0.05;
+            Real rad = sphere.radius + Real(SPHERE_COLLISION_MARGIN);
 
-            float dist = glm::distance(positionArray[k], sphere.center);
+            Real dist = glm::distance(positionArray[k], center);
+
+            if (sleepingTileCount && tileSleepingArray[tileIndex(i, j)]) {
+                if (moved && (dist < rad || glm::distance(positionArray[k], vec3(previous.center)) < previous.radius + Real(SPHERE_COLLISION_MARGIN)))
+                    tileWakeArray.push_back(tileIndex(i, j));
+                continue;
+            }
 
             if ( dist < rad)
             {
-                float d = 1.f/sqrt(dist) - 1.f;
-                glm::vec3 repulseForce = glm::vec3(glm::normalize(positionArray[k] - sphere.center) * d);
-                glm::vec3 brakeForce = - 0.005f * glm::vec3(glm::normalize(positionArray[k] - sphere.center) / dt);
+                Real d = 1/sqrt(dist) - 1;
+                vec3 repulseForce = vec3(glm::normalize(positionArray[k] - center) * d);
+                vec3 brakeForce = Real(-0.005) * vec3(glm::normalize(positionArray[k] - center) / dt);
                 forceArray[k] += repulseForce + brakeForce;
             }
         }
     }
 }
 
-void Flag::update(float dt) {
-    uint k;
-    for (int j = 0; j < gridHeight; ++j) {
-        for (int i = 0; i < gridWidth; ++i) {
-            k = i + j * gridWidth;
-            if (i != 0) {
-                velocityArray[k] += dt * forceArray[k] / massArray[k];
-                positionArray[k] += dt * velocityArray[k];
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::update(Real dt) {
+    bool forcesChanged = externalForce != lastExternalForce;
+    lastExternalForce = externalForce;
+    externalForce = glm::vec3(0.f);
+    colliderCount = 0;
+
+    if (sleepThreshold <= 0 && !sleepingTileCount) {
+        uint k;
+        for (int j = 0; j < gridHeight; ++j) {
+            // First column is fixed
+            forceArray[index(0, j)] = vec3(0.f);
+
+            for (int i = 1; i < gridWidth; ++i) {
+                k = index(i, j);
+                // Arithmetic in Real whatever the storage type
+                vec3 velocity = vec3(velocityArray[k]) + dt * forceArray[k] / Real(massArray[k]);
+                velocityArray[k] = velocity;
+                positionArray[k] += dt * velocity;
+                forceArray[k] = vec3(0.f);
+            }
+        }
+        return;
+    }
+
+    for (int tj = 0; tj < tileCountY; ++tj) {
+        for (int ti = 0; ti < tileCountX; ++ti) {
+            uint tile = ti + tj * tileCountX;
+            if (tileSleepingArray[tile]) {
+                // Drift the change of the force field would give a vertex at rest, as measured below
+                Real delay = Real(SLEEP_STEP_COUNT) * dt;
+                if (Real(0.5) * delay * delay * tileFieldChangeArray[tile] > sleepThreshold)
+                    tileWakeArray.push_back(tile);
+                tileFieldChangeArray[tile] = 0;
+                continue;
+            }
+
+            uint i0 = ti * TILE_SIZE, i1 = std::min(i0 + TILE_SIZE, gridWidth);
+            uint j0 = tj * TILE_SIZE, j1 = std::min(j0 + TILE_SIZE, gridHeight);
+
+            Real energy = 0, mass = 0;
+            for (uint j = j0; j < j1; ++j) {
+                // First column is fixed
+                if (i0 == 0)
+                    forceArray[index(0, j)] = vec3(0.f);
+
+                for (uint i = std::max(i0, 1u); i < i1; ++i) {
+                    uint k = index(i, j);
+                    vec3 acceleration = forceArray[k] / Real(massArray[k]);
+                    vec3 velocity = vec3(velocityArray[k]) + dt * acceleration;
+                    velocityArray[k] = velocity;
+                    positionArray[k] += dt * velocity;
+                    forceArray[k] = vec3(0.f);
+
+                    // Speed reached after the sleep delay, so that a tile out of equilibrium stays awake
+                    vec3 drift = velocity + Real(SLEEP_STEP_COUNT) * dt * acceleration;
+                    energy += Real(0.5) * Real(massArray[k]) * glm::dot(drift, drift);
+                    mass += Real(massArray[k]);
+                }
+            }
+
+            if (energy > sleepThreshold * mass) {
+                // Moving tiles keep their neighbours awake
+                tileQuietStepArray[tile] = 0;
+                for (int nj = tj - 1; nj <= tj + 1; ++nj)
+                    for (int ni = ti - 1; ni <= ti + 1; ++ni)
+                        if (ni >= 0 && nj >= 0 && ni < tileCountX && nj < tileCountY && tileSleepingArray[ni + nj * tileCountX])
+                            tileWakeArray.push_back(ni + nj * tileCountX);
+            } else if (++tileQuietStepArray[tile] >= SLEEP_STEP_COUNT) {
+                tileSleepingArray[tile] = 1;
+                ++sleepingTileCount;
+                for (uint j = j0; j < j1; ++j)
+                    for (uint i = i0; i < i1; ++i)
+                        velocityArray[index(i, j)] = vec3(0.f);
             }
-            forceArray[k] = glm::vec3(0.f);
         }
     }
+
+    // A change of gravity or wind wakes the whole flag
+    if (forcesChanged || sleepThreshold <= 0) {
+        wakeAll();
+        return;
+    }
+
+    for (uint tile : tileWakeArray) {
+        if (!tileSleepingArray[tile])
+            continue;
+        tileSleepingArray[tile] = 0;
+        tileQuietStepArray[tile] = 0;
+        --sleepingTileCount;
+
+        // Forces of a sleeping tile are stale, start from zero
+        uint i0 = (tile % tileCountX) * TILE_SIZE, i1 = std::min(i0 + TILE_SIZE, gridWidth);
+        uint j0 = (tile / tileCountX) * TILE_SIZE, j1 = std::min(j0 + TILE_SIZE, gridHeight);
+        for (uint j = j0; j < j1; ++j)
+            for (uint i = i0; i < i1; ++i)
+                forceArray[index(i, j)] = vec3(0.f);
+    }
+    tileWakeArray.clear();
 }
+
+template<typename Real, typename Storage>
+const uint BasicFlag<Real, Storage>::BLOCK_SIZE;
+
+template<typename Real, typename Storage>
+void BasicFlag<Real, Storage>::stepBlocked(Real dt, uint substepCount, const glm::vec3 &F, const std::vector<Sphere> &spheres) {
+    // A tear changes the topology in the middle of a block : step pass by pass instead
+    if (tearStrain > 0 || !springMaskArray.empty()) {
+        for (uint s = 0; s < substepCount; ++s) {
+            applyExternalForce(F);
+            applyInternalForces(dt);
+            for (const Sphere &sphere : spheres)
+                sphereCollision(sphere, dt);
+            update(dt);
+        }
+        return;
+    }
+
+    if (sleepingTileCount)
+        wakeAll();
+
+    const uint halo = 2 * substepCount;
+
+    blockPositionArray.resize(positionArray.size());
+    blockVelocityArray.resize(velocityArray.size());
+
+    // Patch of the flag around the current block, advanced on its own. Its edges see
+    // truncated springs but the error moves by 2 vertices per substep and stays in the halo.
+    // Kept between calls, so that its arrays are only allocated for the first block.
+    static thread_local BasicFlag patch(1, 1, 1, 2, 2);
+    patch.K0 = K0; patch.K1 = K1; patch.K2 = K2;
+    patch.V0 = V0; patch.V1 = V1; patch.V2 = V2;
+    patch.L0 = L0; patch.L1 = L1; patch.L2 = L2;
+    patch.materialArray = materialArray;
+
+    for (uint bj = 0; bj < gridHeight; bj += BLOCK_SIZE) {
+        for (uint bi = 0; bi < gridWidth; bi += BLOCK_SIZE) {
+            uint i0 = bi >= halo ? bi - halo : 0, i1 = std::min(bi + BLOCK_SIZE + halo, gridWidth);
+            uint j0 = bj >= halo ? bj - halo : 0, j1 = std::min(bj + BLOCK_SIZE + halo, gridHeight);
+
+            patch.gridWidth = i1 - i0;
+            patch.gridHeight = j1 - j0;
+            patch.positionArray.resize(patch.gridWidth * patch.gridHeight);
+            patch.velocityArray.resize(patch.gridWidth * patch.gridHeight);
+            patch.massArray.resize(patch.gridWidth * patch.gridHeight);
+            patch.materialIndexArray.resize(patch.gridWidth * patch.gridHeight);
+            patch.forceArray.assign(patch.gridWidth * patch.gridHeight, vec3(0.f));
+            patch.wakeAll();
+
+            // The first column of the patch is fixed : right for the first block, inside the halo otherwise
+            for (uint j = j0; j < j1; ++j) {
+                for (uint i = i0; i < i1; ++i) {
+                    uint k = index(i, j), p = (i - i0) + (j - j0) * patch.gridWidth;
+                    patch.positionArray[p] = positionArray[k];
+                    patch.velocityArray[p] = velocityArray[k];
+                    patch.massArray[p] = massArray[k];
+                    patch.materialIndexArray[p] = materialIndexArray[k];
+                }
+            }
+
+            for (uint s = 0; s < substepCount; ++s) {
+                patch.applyExternalForce(F);
+                patch.applyInternalForces(dt);
+                for (const Sphere &sphere : spheres)
+                    patch.sphereCollision(sphere, dt);
+                patch.update(dt);
+            }
+
+            uint blockWidth = std::min(BLOCK_SIZE, gridWidth - bi), blockHeight = std::min(BLOCK_SIZE, gridHeight - bj);
+            for (uint j = bj; j < bj + blockHeight; ++j) {
+                for (uint i = bi; i < bi + blockWidth; ++i) {
+                    uint k = index(i, j), p = (i - i0) + (j - j0) * patch.gridWidth;
+                    blockPositionArray[k] = patch.positionArray[p];
+                    blockVelocityArray[k] = patch.velocityArray[p];
+                }
+            }
+        }
+    }
+
+    // Exchange once every block is done, the halos having been read from the previous state
+    positionArray.swap(blockPositionArray);
+    velocityArray.swap(blockVelocityArray);
+    externalForce = lastExternalForce = F;
+}
+
+template struct BasicFlag<float>;
+template struct BasicFlag<double>;
+template struct BasicFlag<float, half>;
@@ -0,0 +1,110 @@
+#include "Utils/FlagNormals.hpp"
+#include "Utils/Parallel.hpp"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace Utils {
+
+FlagNormals::FlagNormals():
+    m_nGridWidth(0), m_nGridHeight(0), m_bVertexNormalsValid(false) {
+}
+
+void FlagNormals::computeFaceNormals(const glm::vec3* positionArray, uint32_t gridWidth, uint32_t gridHeight) {
+    const int w = gridWidth, h = gridHeight, quadCountX = w - 1;
+
+    m_nGridWidth = gridWidth;
+    m_nGridHeight = gridHeight;
+    m_XArray.resize(w * h);
+    m_YArray.resize(w * h);
+    m_ZArray.resize(w * h);
+    m_FaceNormalArray.resize(2 * quadCountX * (h - 1));
+    m_bVertexNormalsValid = false;
+
+    #pragma omp parallel for if(w * h >= PARALLEL_VERTEX_COUNT)
+    for (int k = 0; k < w * h; ++k) {
+        m_XArray[k] = positionArray[k].x;
+        m_YArray[k] = positionArray[k].y;
+        m_ZArray[k] = positionArray[k].z;
+    }
+
+    #pragma omp parallel for if(w * h >= PARALLEL_VERTEX_COUNT)
+    for (int j = 0; j < h - 1; ++j) {
+        const float *x0 = &m_XArray[j * w], *y0 = &m_YArray[j * w], *z0 = &m_ZArray[j * w];
+        const float *x1 = x0 + w, *y1 = y0 + w, *z1 = z0 + w;
+        glm::vec3* faces = &m_FaceNormalArray[2 * j * quadCountX];
+
+        // Quad i: A = (i, j), B = (i + 1, j), C = (i + 1, j + 1), D = (i, j + 1),
+        // triangles ABC and ACD
+        int i = 0;
+#ifdef __SSE__
+        for (; i + 4 <= quadCountX; i += 4) {
+            __m128 ax = _mm_loadu_ps(x0 + i), ay = _mm_loadu_ps(y0 + i), az = _mm_loadu_ps(z0 + i);
+            __m128 bx = _mm_sub_ps(_mm_loadu_ps(x0 + i + 1), ax), by = _mm_sub_ps(_mm_loadu_ps(y0 + i + 1), ay), bz = _mm_sub_ps(_mm_loadu_ps(z0 + i + 1), az);
+            __m128 cx = _mm_sub_ps(_mm_loadu_ps(x1 + i + 1), ax), cy = _mm_sub_ps(_mm_loadu_ps(y1 + i + 1), ay), cz = _mm_sub_ps(_mm_loadu_ps(z1 + i + 1), az);
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(x1 + i), ax), dy = _mm_sub_ps(_mm_loadu_ps(y1 + i), ay), dz = _mm_sub_ps(_mm_loadu_ps(z1 + i), az);
+
+            // AB x AC and AC x AD
+            float n[6][4];
+            _mm_storeu_ps(n[0], _mm_sub_ps(_mm_mul_ps(by, cz), _mm_mul_ps(bz, cy)));
+            _mm_storeu_ps(n[1], _mm_sub_ps(_mm_mul_ps(bz, cx), _mm_mul_ps(bx, cz)));
+            _mm_storeu_ps(n[2], _mm_sub_ps(_mm_mul_ps(bx, cy), _mm_mul_ps(by, cx)));
+            _mm_storeu_ps(n[3], _mm_sub_ps(_mm_mul_ps(cy, dz), _mm_mul_ps(cz, dy)));
+            _mm_storeu_ps(n[4], _mm_sub_ps(_mm_mul_ps(cz, dx), _mm_mul_ps(cx, dz)));
+            _mm_storeu_ps(n[5], _mm_sub_ps(_mm_mul_ps(cx, dy), _mm_mul_ps(cy, dx)));
+
+            for (int l = 0; l < 4; ++l) {
+                faces[2 * (i + l)] = glm::vec3(n[0][l], n[1][l], n[2][l]);
+                faces[2 * (i + l) + 1] = glm::vec3(n[3][l], n[4][l], n[5][l]);
+            }
+        }
+#endif
+        for (; i < quadCountX; ++i) {
+            glm::vec3 A(x0[i], y0[i], z0[i]);
+            glm::vec3 AB = glm::vec3(x0[i + 1], y0[i + 1], z0[i + 1]) - A;
+            glm::vec3 AC = glm::vec3(x1[i + 1], y1[i + 1], z1[i + 1]) - A;
+            glm::vec3 AD = glm::vec3(x1[i], y1[i], z1[i]) - A;
+            faces[2 * i] = glm::cross(AB, AC);
+            faces[2 * i + 1] = glm::cross(AC, AD);
+        }
+    }
+}
+
+const std::vector<glm::vec3>& FlagNormals::getVertexNormals() {
+    if (m_bVertexNormalsValid) {
+        return m_VertexNormalArray;
+    }
+
+    const int w = m_nGridWidth, h = m_nGridHeight, quadCountX = w - 1, quadCountY = h - 1;
+    const glm::vec3* faces = m_FaceNormalArray.data();
+    m_VertexNormalArray.resize(w * h);
+
+    // Vertex (i, j) is A for the quad (i, j), B for (i - 1, j), C for (i - 1, j - 1) and D for (i, j - 1)
+    #pragma omp parallel for if(w * h >= PARALLEL_VERTEX_COUNT)
+    for (int j = 0; j < h; ++j) {
+        for (int i = 0; i < w; ++i) {
+            glm::vec3 N(0.f);
+            if (i < quadCountX && j < quadCountY) {
+                N += faces[2 * (i + j * quadCountX)] + faces[2 * (i + j * quadCountX) + 1];
+            }
+            if (i > 0 && j < quadCountY) {
+                N += faces[2 * (i - 1 + j * quadCountX)];
+            }
+            if (i > 0 && j > 0) {
+                N += faces[2 * (i - 1 + (j - 1) * quadCountX)] + faces[2 * (i - 1 + (j - 1) * quadCountX) + 1];
+            }
+            if (i < quadCountX && j > 0) {
+                N += faces[2 * (i + (j - 1) * quadCountX) + 1];
+            }
+
+            float length2 = glm::dot(N, N);
+            m_VertexNormalArray[i + j * w] = length2 > 0.f ? N / glm::sqrt(length2) : glm::vec3(0.f);
+        }
+    }
+
+    m_bVertexNormalsValid = true;
+    return m_VertexNormalArray;
+}
+
+}
@@ -0,0 +1,167 @@
+#include "Utils/FlagRecording.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Utils {
+
+static const char RECORDING_MAGIC[8] = { 'F', 'L', 'A', 'G', 'R', 'E', 'C', '\0' };
+static const uint32_t RECORDING_VERSION = 1;
+
+FlagRecorder::FlagRecorder(const char* path, uint32_t gridWidth, uint32_t gridHeight):
+    m_Path(path), m_pFile(fopen(path, "wb")), m_bFailed(false) {
+    if(!m_pFile) {
+        throw std::runtime_error(std::string("Unable to create recording ") + path);
+    }
+
+    memcpy(m_Header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    m_Header.version = RECORDING_VERSION;
+    m_Header.gridWidth = gridWidth;
+    m_Header.gridHeight = gridHeight;
+    m_Header.frameCount = 0;
+    m_Header.indexOffset = 0;
+
+    // Placeholder, rewritten by close() once the frame count is known
+    if(fwrite(&m_Header, sizeof(m_Header), 1, m_pFile) != 1) {
+        fclose(m_pFile);
+        throw std::runtime_error(std::string("Unable to write recording ") + path);
+    }
+}
+
+FlagRecorder::~FlagRecorder() {
+    close();
+}
+
+bool FlagRecorder::checkWrite(bool written) {
+    if(!written && !m_bFailed) {
+        std::cerr << "Unable to write recording " << m_Path << ", recording stopped" << std::endl;
+        m_bFailed = true;
+    }
+    return written;
+}
+
+void FlagRecorder::addFrame(const glm::vec3* positionArray, float time) {
+    if(m_bFailed) {
+        return;
+    }
+
+    FlagRecordingIndexEntry entry;
+    entry.offset = sizeof(m_Header) + m_Index.size() * m_Header.gridWidth * m_Header.gridHeight * sizeof(glm::vec3);
+    entry.time = time;
+    entry.padding = 0;
+
+    size_t vertexCount = size_t(m_Header.gridWidth) * m_Header.gridHeight;
+    if(checkWrite(fwrite(positionArray, sizeof(glm::vec3), vertexCount, m_pFile) == vertexCount)) {
+        m_Index.push_back(entry);
+    }
+}
+
+bool FlagRecorder::close() {
+    if(!m_pFile) {
+        return !m_bFailed;
+    }
+
+    // Align the index table so that it can be read in place from the mapping
+    long end = ftell(m_pFile);
+    long padding = (8 - end % 8) % 8;
+    static const char zeros[8] = { 0 };
+
+    if(!m_bFailed && checkWrite(end != -1 && fwrite(zeros, 1, padding, m_pFile) == size_t(padding))) {
+        m_Header.frameCount = m_Index.size();
+        m_Header.indexOffset = end + padding;
+        // The header goes last, once everything it describes is written
+        checkWrite(fwrite(m_Index.data(), sizeof(m_Index[0]), m_Index.size(), m_pFile) == m_Index.size() &&
+                   fflush(m_pFile) == 0 &&
+                   fseek(m_pFile, 0, SEEK_SET) == 0 &&
+                   fwrite(&m_Header, sizeof(m_Header), 1, m_pFile) == 1);
+    }
+
+    checkWrite(fclose(m_pFile) == 0);
+    m_pFile = 0;
+    return !m_bFailed;
+}
+
+FlagPlayback::FlagPlayback(const char* path):
+    m_pData(0), m_nSize(0), m_pHeader(0), m_pIndex(0) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        throw std::runtime_error(std::string("Unable to open recording ") + path);
+    }
+
+    struct stat status;
+    if(fstat(fd, &status) == -1 || size_t(status.st_size) < sizeof(FlagRecordingHeader)) {
+        ::close(fd);
+        throw std::runtime_error(std::string("Invalid recording ") + path);
+    }
+    m_nSize = status.st_size;
+
+    void* data = mmap(0, m_nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED) {
+        throw std::runtime_error(std::string("Unable to map recording ") + path);
+    }
+    m_pData = static_cast<const uint8_t*>(data);
+
+    // Scrubbing jumps anywhere in the file, don't let the kernel read ahead
+    madvise(data, m_nSize, MADV_RANDOM);
+
+    m_pHeader = reinterpret_cast<const FlagRecordingHeader*>(m_pData);
+
+    // Sizes are compared against the file size first, so that none of the sums overflows
+    uint64_t frameSize = uint64_t(m_pHeader->gridWidth) * m_pHeader->gridHeight * sizeof(glm::vec3);
+    uint64_t indexSize = uint64_t(m_pHeader->frameCount) * sizeof(FlagRecordingIndexEntry);
+    bool valid = memcmp(m_pHeader->magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) == 0 &&
+                 m_pHeader->version == RECORDING_VERSION &&
+                 m_pHeader->gridWidth > 1 && m_pHeader->gridHeight > 1 &&
+                 m_pHeader->frameCount > 0 &&
+                 m_pHeader->indexOffset % 8 == 0 &&
+                 m_pHeader->indexOffset <= m_nSize && indexSize <= m_nSize - m_pHeader->indexOffset &&
+                 frameSize <= m_pHeader->indexOffset;
+
+    // Every frame lies between the header and the index, where getFrame() reads it in place
+    if(valid) {
+        m_pIndex = reinterpret_cast<const FlagRecordingIndexEntry*>(m_pData + m_pHeader->indexOffset);
+        for(uint32_t frame = 0; frame < m_pHeader->frameCount && valid; ++frame) {
+            uint64_t offset = m_pIndex[frame].offset;
+            valid = offset >= sizeof(FlagRecordingHeader) && offset % alignof(glm::vec3) == 0 &&
+                    offset <= m_pHeader->indexOffset - frameSize;
+        }
+    }
+
+    if(!valid) {
+        munmap(data, m_nSize);
+        throw std::runtime_error(std::string("Invalid recording ") + path);
+    }
+}
+
+FlagPlayback::~FlagPlayback() {
+    munmap(const_cast<uint8_t*>(m_pData), m_nSize);
+}
+
+uint32_t FlagPlayback::findFrame(float time) const {
+    const FlagRecordingIndexEntry* last = m_pIndex + getFrameCount();
+    const FlagRecordingIndexEntry* entry = std::upper_bound(m_pIndex, last, time,
+        [](float t, const FlagRecordingIndexEntry& e) { return t < e.time; });
+
+    return entry == m_pIndex ? 0 : uint32_t(entry - m_pIndex) - 1;
+}
+
+void FlagPlayback::prefetch(uint32_t frame) const {
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    size_t begin = m_pIndex[frame].offset;
+    size_t end = begin + size_t(getGridWidth()) * getGridHeight() * sizeof(glm::vec3);
+    begin -= begin % pageSize;
+
+    madvise(const_cast<uint8_t*>(m_pData) + begin, end - begin, MADV_WILLNEED);
+}
+
+}
@@ -0,0 +1,239 @@
+#include "Utils/FlagSnapshot.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Utils {
+
+static const char SNAPSHOT_MAGIC[8] = { 'F', 'L', 'A', 'G', 'S', 'N', 'A', 'P' };
+static const uint32_t SNAPSHOT_VERSION = 4;
+
+template<typename T>
+static bool writeValue(FILE* file, const T& value) {
+    return fwrite(&value, sizeof(T), 1, file) == 1;
+}
+
+template<typename T>
+static bool writeArray(FILE* file, const std::vector<T>& array) {
+    uint64_t size = array.size();
+    return writeValue(file, size) && fwrite(array.data(), sizeof(T), array.size(), file) == array.size();
+}
+
+template<typename T>
+static bool readValue(FILE* file, T& value) {
+    return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+template<typename T>
+static bool readArray(FILE* file, std::vector<T>& array, uint64_t minSize, uint64_t maxSize) {
+    uint64_t size;
+    if(!readValue(file, size) || size < minSize || size > maxSize) {
+        return false;
+    }
+    array.resize(size);
+    return fread(array.data(), sizeof(T), size, file) == size;
+}
+
+template<typename T>
+static bool readArray(FILE* file, std::vector<T>& array, uint64_t expectedSize) {
+    return readArray(file, array, expectedSize, expectedSize);
+}
+
+static bool writeSnapshot(FILE* file, const Flag& flag, const std::vector<Sphere>& spheres) {
+    uint32_t sphereCount = spheres.size();
+    uint32_t layout = flag.layout;
+
+    bool ok = fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC), 1, file) == 1 &&
+              writeValue(file, SNAPSHOT_VERSION) &&
+              writeValue(file, flag.gridWidth) && writeValue(file, flag.gridHeight) && writeValue(file, layout) &&
+              writeValue(file, flag.L0) && writeValue(file, flag.L1) && writeValue(file, flag.L2) &&
+              writeValue(file, flag.K0) && writeValue(file, flag.K1) && writeValue(file, flag.K2) &&
+              writeValue(file, flag.V0) && writeValue(file, flag.V1) && writeValue(file, flag.V2) &&
+              writeArray(file, flag.positionArray) &&
+              writeArray(file, flag.velocityArray) &&
+              writeArray(file, flag.massArray) &&
+              writeArray(file, flag.materialArray) &&
+              writeArray(file, flag.materialIndexArray) &&
+              writeValue(file, flag.tearStrain) &&
+              writeArray(file, flag.springMaskArray) &&
+              writeValue(file, sphereCount);
+
+    for(const Sphere& sphere : spheres) {
+        ok = ok && writeValue(file, sphere.center) && writeValue(file, sphere.radius);
+    }
+    return ok;
+}
+
+bool saveSnapshot(const char* path, const Flag& flag, const std::vector<Sphere>& spheres) {
+    // Write next to the destination then rename, so that a reader never sees a partial file
+    std::string tmpPath = std::string(path) + ".tmp" + std::to_string(getpid());
+
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if(!file) {
+        std::cerr << "Unable to write snapshot " << path << std::endl;
+        return false;
+    }
+
+    bool ok = writeSnapshot(file, flag, spheres);
+    ok = fclose(file) == 0 && ok;
+
+    if(!ok || rename(tmpPath.c_str(), path) != 0) {
+        std::cerr << "Unable to write snapshot " << path << std::endl;
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool loadSnapshot(const char* path, Flag& flag, std::vector<Sphere>& spheres) {
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        return false;
+    }
+
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    uint32_t version, gridWidth, gridHeight, layout, sphereCount;
+
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) &&
+              readValue(file, version) && version == SNAPSHOT_VERSION &&
+              readValue(file, gridWidth) && readValue(file, gridHeight) && readValue(file, layout) &&
+              (layout == ROW_MAJOR || (layout == TILED && gridWidth % Flag::TILE_SIZE == 0 && gridHeight % Flag::TILE_SIZE == 0));
+
+    // Read into a copy so that a truncated file leaves the flag untouched
+    Flag loaded = flag;
+    std::vector<uint8_t> springMaskArray;
+    uint64_t vertexCount = uint64_t(gridWidth) * gridHeight;
+
+    ok = ok && readValue(file, loaded.L0) && readValue(file, loaded.L1) && readValue(file, loaded.L2) &&
+         readValue(file, loaded.K0) && readValue(file, loaded.K1) && readValue(file, loaded.K2) &&
+         readValue(file, loaded.V0) && readValue(file, loaded.V1) && readValue(file, loaded.V2) &&
+         readArray(file, loaded.positionArray, vertexCount) &&
+         readArray(file, loaded.velocityArray, vertexCount) &&
+         readArray(file, loaded.massArray, vertexCount) &&
+         readArray(file, loaded.materialArray, 1, 256) &&
+         readArray(file, loaded.materialIndexArray, vertexCount) &&
+         readValue(file, loaded.tearStrain) &&
+         readArray(file, springMaskArray, 0, vertexCount) &&
+         (springMaskArray.empty() || springMaskArray.size() == vertexCount) &&
+         readValue(file, sphereCount);
+
+    for(uint8_t material : loaded.materialIndexArray) {
+        ok = ok && material < loaded.materialArray.size();
+    }
+
+    std::vector<Sphere> loadedSpheres;
+    for(uint32_t i = 0; ok && i < sphereCount; ++i) {
+        Sphere sphere(glm::vec3(0.f), 0.f);
+        ok = readValue(file, sphere.center) && readValue(file, sphere.radius);
+        loadedSpheres.push_back(sphere);
+    }
+    fclose(file);
+
+    if(!ok) {
+        std::cerr << "Invalid snapshot " << path << std::endl;
+        return false;
+    }
+
+    loaded.gridWidth = gridWidth;
+    loaded.gridHeight = gridHeight;
+    loaded.layout = FlagLayout(layout);
+    loaded.forceArray.assign(vertexCount, glm::vec3(0.f));
+    loaded.wakeAll();
+
+    // Tear again the broken springs, so that the renderer gets their triangles
+    loaded.springMaskArray.clear();
+    loaded.tornTriangleArray.clear();
+    loaded.faceTornArray.clear();
+    for(uint j = 0; j < gridHeight && !springMaskArray.empty(); ++j) {
+        for(uint i = 0; i < gridWidth; ++i) {
+            for(int direction = 0; direction < SPRING_DIRECTION_COUNT; ++direction) {
+                if(!(springMaskArray[loaded.index(i, j)] & (1 << direction))) {
+                    loaded.tearSpring(i, j, SpringDirection(direction));
+                }
+            }
+        }
+    }
+
+    flag = loaded;
+    spheres = loadedSpheres;
+    return true;
+}
+
+// FNV-1a
+static void hashBytes(uint64_t& hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+template<typename T>
+static void hashValue(uint64_t& hash, const T& value) {
+    hashBytes(hash, &value, sizeof(T));
+}
+
+uint64_t snapshotKey(const Flag& flag, const std::vector<Sphere>& spheres,
+                     const glm::vec3& gravity, const glm::vec3& wind,
+                     float dt, uint32_t stepCount) {
+    uint64_t hash = 14695981039346656037ull;
+
+    hashValue(hash, SNAPSHOT_VERSION);
+    hashValue(hash, flag.gridWidth);
+    hashValue(hash, flag.gridHeight);
+    hashValue(hash, flag.layout);
+    hashValue(hash, flag.L0);
+    hashValue(hash, flag.L1);
+    hashValue(hash, flag.L2);
+    hashValue(hash, flag.K0);
+    hashValue(hash, flag.K1);
+    hashValue(hash, flag.K2);
+    hashValue(hash, flag.V0);
+    hashValue(hash, flag.V1);
+    hashValue(hash, flag.V2);
+    hashBytes(hash, flag.positionArray.data(), flag.positionArray.size() * sizeof(flag.positionArray[0]));
+    hashBytes(hash, flag.velocityArray.data(), flag.velocityArray.size() * sizeof(flag.velocityArray[0]));
+    hashBytes(hash, flag.massArray.data(), flag.massArray.size() * sizeof(flag.massArray[0]));
+    hashBytes(hash, flag.materialArray.data() + 1, (flag.materialArray.size() - 1) * sizeof(flag.materialArray[0]));
+    hashBytes(hash, flag.materialIndexArray.data(), flag.materialIndexArray.size());
+    hashValue(hash, flag.tearStrain);
+    hashBytes(hash, flag.springMaskArray.data(), flag.springMaskArray.size());
+
+    for(const Sphere& sphere : spheres) {
+        hashValue(hash, sphere.center);
+        hashValue(hash, sphere.radius);
+    }
+
+    hashValue(hash, gravity);
+    hashValue(hash, wind);
+    hashValue(hash, dt);
+    hashValue(hash, stepCount);
+
+    return hash;
+}
+
+SnapshotCache::SnapshotCache(const std::string& directory):
+    m_Directory(directory) {
+}
+
+bool SnapshotCache::load(uint64_t key, Flag& flag, std::vector<Sphere>& spheres) const {
+    return loadSnapshot(getPath(key).c_str(), flag, spheres);
+}
+
+bool SnapshotCache::save(uint64_t key, const Flag& flag, const std::vector<Sphere>& spheres) const {
+    mkdir(m_Directory.c_str(), 0755);
+    return saveSnapshot(getPath(key).c_str(), flag, spheres);
+}
+
+std::string SnapshotCache::getPath(uint64_t key) const {
+    std::ostringstream path;
+    path << m_Directory << "/" << std::hex << key << ".flagsnap";
+    return path.str();
+}
+
+}
@@ -0,0 +1,119 @@
+#include "Utils/HeadlessContext.hpp"
+
+#include <stdexcept>
+#include <string>
+
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace Utils {
+
+#ifdef USE_EGL
+
+HeadlessContext::HeadlessContext(uint32_t width, uint32_t height):
+    m_nWidth(width), m_nHeight(height), m_pDisplay(nullptr), m_pContext(nullptr),
+    m_FBOID(0), m_RenderbufferIDs() {
+
+    // The surfaceless platform needs neither X nor a window, the default display is the fallback
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if(getPlatformDisplay) {
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    if(display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint major, minor;
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        throw std::runtime_error("Unable to initialize EGL");
+    }
+    m_pDisplay = display;
+
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        throw std::runtime_error("EGL does not support desktop OpenGL");
+    }
+
+    // Any OpenGL config: nothing is drawn to an EGL surface
+    const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    if(!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || !configCount) {
+        config = nullptr; // EGL_KHR_no_config_context
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if(context == EGL_NO_CONTEXT) {
+        throw std::runtime_error("Unable to create an OpenGL 3.3 core context");
+    }
+    m_pContext = context;
+
+    if(!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        throw std::runtime_error("Unable to make the context current without a surface");
+    }
+
+    // GLEW built for GLX loads the entry points, then complains about the missing X display
+    glewExperimental = GL_TRUE;
+    GLenum error = glewInit();
+    if(error != GLEW_OK && error != GLEW_ERROR_NO_GLX_DISPLAY) {
+        throw std::runtime_error(std::string("Unable to init GLEW: ") + std::string(reinterpret_cast<const char*>(glewGetErrorString(error))));
+    }
+    glGetError(); // glewInit may leave GL_INVALID_ENUM behind on core contexts
+
+    // Framebuffer, left bound for the whole run
+    glGenFramebuffers(1, &m_FBOID);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBOID);
+
+    glGenRenderbuffers(2, m_RenderbufferIDs);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_RenderbufferIDs[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_RenderbufferIDs[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_RenderbufferIDs[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_RenderbufferIDs[1]);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error("Incomplete offscreen framebuffer");
+    }
+
+    glViewport(0, 0, width, height);
+}
+
+HeadlessContext::~HeadlessContext() {
+    if(m_FBOID) {
+        glDeleteFramebuffers(1, &m_FBOID);
+        glDeleteRenderbuffers(2, m_RenderbufferIDs);
+    }
+    if(m_pContext) {
+        eglMakeCurrent(m_pDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_pDisplay, m_pContext);
+    }
+    if(m_pDisplay) {
+        eglTerminate(m_pDisplay);
+    }
+}
+
+#else
+
+HeadlessContext::HeadlessContext(uint32_t width, uint32_t height):
+    m_nWidth(width), m_nHeight(height), m_pDisplay(nullptr), m_pContext(nullptr),
+    m_FBOID(0), m_RenderbufferIDs() {
+    throw std::runtime_error("Headless rendering needs EGL, which was not found at configure time");
+}
+
+HeadlessContext::~HeadlessContext() {
+}
+
+#endif
+
+}
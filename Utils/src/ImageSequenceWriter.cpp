@@ -0,0 +1,269 @@
+#include "Utils/ImageSequenceWriter.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace Utils {
+
+static bool endsWith(const std::string& string, const std::string& suffix) {
+    return string.size() >= suffix.size() && string.compare(string.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t size) {
+    static uint32_t table[256] = {};
+    if(!table[1]) {
+        for(uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+
+    crc = ~crc;
+    for(size_t k = 0; k < size; ++k) {
+        crc = table[(crc ^ data[k]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void putBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void putChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size) {
+    putBigEndian(out, size);
+    size_t typeOffset = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    putBigEndian(out, crc32Update(0, &out[typeOffset], 4 + size));
+}
+
+// A single integer conversion (%d, %i or %u with flags and width, such as %04d) and no
+// other %, so that the pattern is safe to give to snprintf with the frame number
+static bool isFramePattern(const std::string& path) {
+    size_t conversionCount = 0;
+    for(size_t k = 0; k < path.size(); ++k) {
+        if(path[k] != '%') {
+            continue;
+        }
+        k = path.find_first_not_of("0123456789-+ ", k + 1);
+        if(k == std::string::npos || (path[k] != 'd' && path[k] != 'i' && path[k] != 'u')) {
+            return false;
+        }
+        ++conversionCount;
+    }
+    return conversionCount == 1;
+}
+
+#ifndef USE_ZLIB
+// zlib stream of stored blocks, when zlib is not available
+static void storeZlib(const std::vector<uint8_t>& data, std::vector<uint8_t>& out) {
+    out.clear();
+    out.push_back(0x78);
+    out.push_back(0x01);
+
+    uint32_t a = 1, b = 0;
+    for(size_t offset = 0; ; ) {
+        size_t size = std::min<size_t>(data.size() - offset, 0xFFFF);
+        bool last = offset + size == data.size();
+        out.push_back(last ? 1 : 0);
+        out.push_back(size & 0xFF);
+        out.push_back(size >> 8);
+        out.push_back(~size & 0xFF);
+        out.push_back((~size >> 8) & 0xFF);
+        out.insert(out.end(), data.begin() + offset, data.begin() + offset + size);
+
+        for(size_t k = offset; k < offset + size; ++k) {
+            a = (a + data[k]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += size;
+        if(last) {
+            break;
+        }
+    }
+    putBigEndian(out, (b << 16) | a);
+}
+#endif
+
+ImageSequenceWriter::ImageSequenceWriter(const std::string& path, uint32_t width, uint32_t height, uint32_t framerate):
+    m_Path(path), m_nWidth(width), m_nHeight(height), m_pVideoFile(nullptr), m_bDone(false) {
+
+    if(endsWith(path, ".y4m")) {
+        m_pVideoFile = fopen(path.c_str(), "wb");
+        if(!m_pVideoFile) {
+            throw std::runtime_error("Unable to create video " + path);
+        }
+        // Limited range BT.601, what players assume of Y4M, chroma sited as JPEG
+        fprintf(m_pVideoFile, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, framerate);
+    } else if(!isFramePattern(path)) {
+        throw std::runtime_error("Image sequence " + path + " needs a single frame number conversion such as %04d");
+    }
+
+    m_Thread = std::thread(&ImageSequenceWriter::run, this);
+}
+
+ImageSequenceWriter::~ImageSequenceWriter() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bDone = true;
+    }
+    m_Condition.notify_all();
+    m_Thread.join();
+
+    if(m_pVideoFile) {
+        fclose(m_pVideoFile);
+    }
+}
+
+std::vector<uint8_t> ImageSequenceWriter::takeBuffer() {
+    std::vector<uint8_t> buffer;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(!m_FreeBuffers.empty()) {
+            buffer.swap(m_FreeBuffers.back());
+            m_FreeBuffers.pop_back();
+        }
+    }
+    buffer.resize(m_nWidth * m_nHeight * 4);
+    return buffer;
+}
+
+void ImageSequenceWriter::addFrame(std::vector<uint8_t>&& pixels) {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Condition.wait(lock, [this] { return m_FrameQueue.size() < MAX_QUEUED_FRAME_COUNT; });
+    m_FrameQueue.push_back(std::move(pixels));
+    lock.unlock();
+    m_Condition.notify_all();
+}
+
+void ImageSequenceWriter::run() {
+    for(uint32_t frameIndex = 0; ; ++frameIndex) {
+        std::vector<uint8_t> pixels;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Condition.wait(lock, [this] { return m_bDone || !m_FrameQueue.empty(); });
+            if(m_FrameQueue.empty()) {
+                return;
+            }
+            pixels.swap(m_FrameQueue.front());
+            m_FrameQueue.pop_front();
+        }
+        m_Condition.notify_all();
+
+        if(m_pVideoFile) {
+            writeY4M(pixels);
+        } else {
+            writePNG(pixels, frameIndex);
+        }
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_FreeBuffers.push_back(std::move(pixels));
+    }
+}
+
+void ImageSequenceWriter::writePNG(const std::vector<uint8_t>& pixels, uint32_t frameIndex) {
+    // RGB rows from the top, each one after its filter type (none)
+    const size_t rowSize = 3 * m_nWidth + 1;
+    m_RowData.resize(rowSize * m_nHeight);
+    for(uint32_t y = 0; y < m_nHeight; ++y) {
+        const uint8_t* src = &pixels[4 * m_nWidth * (m_nHeight - 1 - y)];
+        uint8_t* dst = &m_RowData[rowSize * y];
+        *dst++ = 0;
+        for(uint32_t x = 0; x < m_nWidth; ++x, src += 4, dst += 3) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+        }
+    }
+
+    std::vector<uint8_t> compressed;
+#ifdef USE_ZLIB
+    uLongf compressedSize = compressBound(m_RowData.size());
+    compressed.resize(compressedSize);
+    if(compress2(compressed.data(), &compressedSize, m_RowData.data(), m_RowData.size(), Z_BEST_SPEED) != Z_OK) {
+        std::cerr << "Unable to compress frame " << frameIndex << std::endl;
+        return;
+    }
+    compressed.resize(compressedSize);
+#else
+    storeZlib(m_RowData, compressed);
+#endif
+
+    m_EncodedData.clear();
+    static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    m_EncodedData.insert(m_EncodedData.end(), SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, m_nWidth);
+    putBigEndian(header, m_nHeight);
+    header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bits RGB, deflate, no filter, no interlace
+    putChunk(m_EncodedData, "IHDR", header.data(), header.size());
+    putChunk(m_EncodedData, "IDAT", compressed.data(), compressed.size());
+    putChunk(m_EncodedData, "IEND", nullptr, 0);
+
+    char path[1024];
+    if(snprintf(path, sizeof(path), m_Path.c_str(), frameIndex) >= int(sizeof(path))) {
+        std::cerr << "Path too long for frame " << frameIndex << std::endl;
+        return;
+    }
+    FILE* file = fopen(path, "wb");
+    if(!file || fwrite(m_EncodedData.data(), 1, m_EncodedData.size(), file) != m_EncodedData.size()) {
+        std::cerr << "Unable to write " << path << std::endl;
+    }
+    if(file) {
+        fclose(file);
+    }
+}
+
+void ImageSequenceWriter::writeY4M(const std::vector<uint8_t>& pixels) {
+    const uint32_t w = m_nWidth, h = m_nHeight, chromaWidth = (w + 1) / 2, chromaHeight = (h + 1) / 2;
+    m_EncodedData.resize(w * h + 2 * chromaWidth * chromaHeight);
+    uint8_t* Y = m_EncodedData.data();
+    uint8_t* U = Y + w * h;
+    uint8_t* V = U + chromaWidth * chromaHeight;
+
+    // Rows from the top
+    auto pixel = [&](uint32_t x, uint32_t y) {
+        return &pixels[4 * (std::min(x, w - 1) + (h - 1 - std::min(y, h - 1)) * w)];
+    };
+
+    for(uint32_t y = 0; y < h; ++y) {
+        for(uint32_t x = 0; x < w; ++x) {
+            const uint8_t* p = pixel(x, y);
+            Y[x + y * w] = uint8_t(16.f + 0.256788f * p[0] + 0.504129f * p[1] + 0.097906f * p[2] + 0.5f);
+        }
+    }
+
+    // Chroma of the average of each 2x2 block. Luma spans [16, 235] and chroma [16, 240].
+    for(uint32_t y = 0; y < chromaHeight; ++y) {
+        for(uint32_t x = 0; x < chromaWidth; ++x) {
+            float r = 0.f, g = 0.f, b = 0.f;
+            for(uint32_t k = 0; k < 4; ++k) {
+                const uint8_t* p = pixel(2 * x + k % 2, 2 * y + k / 2);
+                r += 0.25f * p[0];
+                g += 0.25f * p[1];
+                b += 0.25f * p[2];
+            }
+            U[x + y * chromaWidth] = uint8_t(128.f - 0.148223f * r - 0.290993f * g + 0.439216f * b + 0.5f);
+            V[x + y * chromaWidth] = uint8_t(128.f + 0.439216f * r - 0.367788f * g - 0.071427f * b + 0.5f);
+        }
+    }
+
+    fputs("FRAME\n", m_pVideoFile);
+    if(fwrite(m_EncodedData.data(), 1, m_EncodedData.size(), m_pVideoFile) != m_EncodedData.size()) {
+        std::cerr << "Unable to write to " << m_Path << std::endl;
+    }
+}
+
+}
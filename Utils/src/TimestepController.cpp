@@ -0,0 +1,123 @@
+#include "Utils/TimestepController.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Utils {
+
+// Fraction of the theoretical stability limit actually used
+static const float SAFETY_FACTOR = 0.8f;
+// Largest change of a spring length in one substep, relative to its rest length
+static const float MAX_STRAIN_PER_STEP = 0.1f;
+// Kinetic energy growth in one substep considered as a blow-up
+static const float MAX_ENERGY_GROWTH = 4.f;
+// Stable substeps before the timestep is allowed to grow again
+static const uint32_t GROWTH_DELAY = 16;
+static const float GROWTH_FACTOR = 1.25f;
+static const uint32_t MAX_SUBSTEP_COUNT = 64;
+
+TimestepController::TimestepController(float minDt, float maxDt):
+    m_fDt(maxDt), m_fMinDt(minDt), m_fMaxDt(maxDt),
+    m_nSubstepCount(0), m_nRollbackCount(0), m_nStableStepCount(0),
+    m_nSavedTornTriangleCount(0), m_nSavedSleepingTileCount(0) {
+}
+
+float TimestepController::estimateStableTimestep(const Flag& flag) const {
+    float minMass = flag.massArray[0], maxSpeed2 = 0.f;
+    for (size_t k = 0; k < flag.massArray.size(); ++k) {
+        minMass = glm::min(minMass, flag.massArray[k]);
+        maxSpeed2 = glm::max(maxSpeed2, glm::dot(flag.velocityArray[k], flag.velocityArray[k]));
+    }
+
+    // Stiffness limit: each vertex has up to 4 springs of each topology, so by
+    // Gershgorin the highest frequency is below sqrt(8 * (K0 + K1 + K2) / m),
+    // and the explicit integrator needs dt * omega < 2
+    float omega = std::sqrt(8.f * flag.maxStiffness() / minMass);
+    float dt = SAFETY_FACTOR * 2.f / omega;
+
+    // Strain rate limit: two ends moving apart at the highest speed must not
+    // stretch a spring by more than a fraction of its rest length
+    float maxSpeed = std::sqrt(maxSpeed2);
+    if (maxSpeed > 0.f) {
+        float restLength = glm::min(flag.L0.x, flag.L0.y);
+        dt = glm::min(dt, MAX_STRAIN_PER_STEP * restLength / (2.f * maxSpeed));
+    }
+
+    return glm::clamp(dt, m_fMinDt, m_fMaxDt);
+}
+
+float TimestepController::kineticEnergy(const Flag& flag) const {
+    float energy = 0.f;
+    for (size_t k = 0; k < flag.velocityArray.size(); ++k) {
+        energy += 0.5f * flag.massArray[k] * glm::dot(flag.velocityArray[k], flag.velocityArray[k]);
+    }
+    return energy;
+}
+
+float TimestepController::advance(Flag& flag, float frameDt, const std::function<void(float)>& step) {
+    float totalMass = 0.f;
+    for (float mass : flag.massArray) {
+        totalMass += mass;
+    }
+    // Below this the kinetic energy is too small for its growth to mean anything
+    float energyFloor = 0.5f * totalMass * glm::dot(flag.L0, flag.L0);
+
+    float energy = kineticEnergy(flag);
+    float time = 0.f;
+    m_nSubstepCount = 0;
+
+    while (time < frameDt && m_nSubstepCount < MAX_SUBSTEP_COUNT) {
+        float dt = glm::min(m_fDt, estimateStableTimestep(flag));
+        dt = glm::min(dt, frameDt - time);
+
+        m_SavedPositionArray = flag.positionArray;
+        m_SavedVelocityArray = flag.velocityArray;
+        m_SavedSpringMaskArray = flag.springMaskArray;
+        m_nSavedTornTriangleCount = flag.tornTriangleArray.size();
+        m_SavedFaceTornArray = flag.faceTornArray;
+        m_SavedTileSleepingArray = flag.tileSleepingArray;
+        m_SavedTileQuietStepArray = flag.tileQuietStepArray;
+        m_nSavedSleepingTileCount = flag.sleepingTileCount;
+
+        step(dt);
+        ++m_nSubstepCount;
+
+        float newEnergy = kineticEnergy(flag);
+        if (std::isfinite(newEnergy) && newEnergy <= MAX_ENERGY_GROWTH * glm::max(energy, energyFloor)) {
+            time += dt;
+            energy = newEnergy;
+
+            if (++m_nStableStepCount >= GROWTH_DELAY) {
+                m_fDt = glm::min(m_fDt * GROWTH_FACTOR, m_fMaxDt);
+                m_nStableStepCount = 0;
+            }
+            continue;
+        }
+
+        // Blow-up: restore the state and retry with a smaller step
+        flag.positionArray = m_SavedPositionArray;
+        flag.velocityArray = m_SavedVelocityArray;
+        // Springs broken by the blow-up are mended
+        flag.springMaskArray = m_SavedSpringMaskArray;
+        flag.tornTriangleArray.resize(m_nSavedTornTriangleCount);
+        flag.faceTornArray = m_SavedFaceTornArray;
+        // Tiles fall asleep or wake up again as in the restored state
+        flag.tileSleepingArray = m_SavedTileSleepingArray;
+        flag.tileQuietStepArray = m_SavedTileQuietStepArray;
+        flag.sleepingTileCount = m_nSavedSleepingTileCount;
+        ++m_nRollbackCount;
+        m_nStableStepCount = 0;
+
+        if (dt <= m_fMinDt) {
+            // Even the smallest step diverges: stop the motion and skip this step
+            std::fill(flag.velocityArray.begin(), flag.velocityArray.end(), glm::vec3(0.f));
+            energy = 0.f;
+            time += dt;
+        }
+        m_fDt = glm::max(0.5f * dt, m_fMinDt);
+    }
+
+    return time;
+}
+
+}
@@ -0,0 +1,124 @@
+#include "Utils/WindField.hpp"
+
+#include <glm/gtc/noise.hpp>
+#include <algorithm>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace Utils {
+
+WindField::WindField(const glm::vec3& minCorner, const glm::vec3& maxCorner, uint32_t resolution):
+    m_MinCorner(minCorner), m_InvCellSize(float(resolution - 1) / (maxCorner - minCorner)),
+    m_nResolution(resolution),
+    m_fStrength(0.01f), m_fFrequency(0.25f), m_fKeyInterval(10.f),
+    m_fKeyTime(0.f), m_bKeysValid(false),
+    m_LatticeArray(resolution * resolution * resolution, glm::vec4(0.f)) {
+}
+
+glm::vec3 WindField::potential(const glm::vec3& position, float time) const {
+    // Three decorrelated noises, time being the fourth dimension
+    glm::vec3 p = position * m_fFrequency;
+    return glm::vec3(glm::simplex(glm::vec4(p, time)),
+                     glm::simplex(glm::vec4(p + glm::vec3(31.4f, 0.f, 0.f), time)),
+                     glm::simplex(glm::vec4(p + glm::vec3(0.f, 0.f, 27.1f), time)));
+}
+
+void WindField::computeKeyLattice(float time, std::vector<glm::vec4>& lattice) {
+    const uint32_t R = m_nResolution;
+    glm::vec3 cellSize = 1.f / m_InvCellSize;
+
+    // The noise changes by about one feature per key interval
+    float noiseTime = time / m_fKeyInterval;
+
+    m_PotentialArray.resize(R * R * R);
+    for (uint32_t z = 0; z < R; ++z)
+        for (uint32_t y = 0; y < R; ++y)
+            for (uint32_t x = 0; x < R; ++x)
+                m_PotentialArray[x + (y + z * R) * R] = potential(m_MinCorner + glm::vec3(x, y, z) * cellSize, noiseTime);
+
+    // Curl by finite differences between nodes, one-sided on the border. Derivatives are
+    // taken in noise space so that the magnitude does not depend on the frequency.
+    auto derivative = [&](uint32_t x, uint32_t y, uint32_t z, int axis) {
+        glm::uvec3 node(x, y, z), lo(node), hi(node);
+        lo[axis] = node[axis] > 0 ? node[axis] - 1 : 0;
+        hi[axis] = glm::min(node[axis] + 1, R - 1);
+        return (m_PotentialArray[hi.x + (hi.y + hi.z * R) * R] - m_PotentialArray[lo.x + (lo.y + lo.z * R) * R]) *
+               (m_InvCellSize[axis] / (m_fFrequency * float(hi[axis] - lo[axis])));
+    };
+
+    lattice.resize(R * R * R);
+    for (uint32_t z = 0; z < R; ++z) {
+        for (uint32_t y = 0; y < R; ++y) {
+            for (uint32_t x = 0; x < R; ++x) {
+                glm::vec3 dx = derivative(x, y, z, 0), dy = derivative(x, y, z, 1), dz = derivative(x, y, z, 2);
+                lattice[x + (y + z * R) * R] = glm::vec4(dy.z - dz.y, dz.x - dx.z, dx.y - dy.x, 0.f);
+            }
+        }
+    }
+}
+
+void WindField::setTime(float time) {
+    if (!m_bKeysValid || time < m_fKeyTime || time >= m_fKeyTime + 2.f * m_fKeyInterval) {
+        // First call or jump in time: both keys are evaluated
+        m_fKeyTime = glm::floor(time / m_fKeyInterval) * m_fKeyInterval;
+        computeKeyLattice(m_fKeyTime, m_KeyLatticeArray[0]);
+        computeKeyLattice(m_fKeyTime + m_fKeyInterval, m_KeyLatticeArray[1]);
+        m_bKeysValid = true;
+    } else if (time >= m_fKeyTime + m_fKeyInterval) {
+        m_fKeyTime += m_fKeyInterval;
+        m_KeyLatticeArray[0].swap(m_KeyLatticeArray[1]);
+        computeKeyLattice(m_fKeyTime + m_fKeyInterval, m_KeyLatticeArray[1]);
+    }
+
+    float alpha = (time - m_fKeyTime) / m_fKeyInterval;
+    for (size_t n = 0; n < m_LatticeArray.size(); ++n) {
+        m_LatticeArray[n] = m_fStrength * glm::mix(m_KeyLatticeArray[0][n], m_KeyLatticeArray[1][n], alpha);
+    }
+}
+
+void WindField::sample(const glm::vec3* positionArray, glm::vec3* windArray, size_t count) const {
+    const uint32_t R = m_nResolution;
+    const float maxCoord = float(R - 1);
+    const glm::vec4* lattice = m_LatticeArray.data();
+
+    for (size_t k = 0; k < count; ++k) {
+        // Cell and position inside it, the last cell being extended to the border of the box
+        glm::vec3 coord = (positionArray[k] - m_MinCorner) * m_InvCellSize;
+        coord = glm::vec3(std::min(std::max(coord.x, 0.f), maxCoord),
+                          std::min(std::max(coord.y, 0.f), maxCoord),
+                          std::min(std::max(coord.z, 0.f), maxCoord));
+        uint32_t x = std::min(uint32_t(coord.x), R - 2), y = std::min(uint32_t(coord.y), R - 2), z = std::min(uint32_t(coord.z), R - 2);
+        glm::vec3 t = coord - glm::vec3(x, y, z);
+
+        // Corners of the cell, the x neighbour being the next node
+        const glm::vec4* c00 = lattice + x + (y + z * R) * R;
+        const glm::vec4* c10 = c00 + R;
+        const glm::vec4* c01 = c00 + R * R;
+        const glm::vec4* c11 = c01 + R;
+
+#ifdef __SSE__
+        // One node per register: lerp along x, then y, then z
+        auto lerp = [](__m128 a, __m128 b, __m128 t) {
+            return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+        };
+        __m128 tx = _mm_set1_ps(t.x), ty = _mm_set1_ps(t.y), tz = _mm_set1_ps(t.z);
+
+        __m128 x00 = lerp(_mm_loadu_ps(&c00[0].x), _mm_loadu_ps(&c00[1].x), tx);
+        __m128 x10 = lerp(_mm_loadu_ps(&c10[0].x), _mm_loadu_ps(&c10[1].x), tx);
+        __m128 x01 = lerp(_mm_loadu_ps(&c01[0].x), _mm_loadu_ps(&c01[1].x), tx);
+        __m128 x11 = lerp(_mm_loadu_ps(&c11[0].x), _mm_loadu_ps(&c11[1].x), tx);
+
+        float wind[4];
+        _mm_storeu_ps(wind, lerp(lerp(x00, x10, ty), lerp(x01, x11, ty), tz));
+        windArray[k] = glm::vec3(wind[0], wind[1], wind[2]);
+#else
+        glm::vec4 x00 = glm::mix(c00[0], c00[1], t.x), x10 = glm::mix(c10[0], c10[1], t.x);
+        glm::vec4 x01 = glm::mix(c01[0], c01[1], t.x), x11 = glm::mix(c11[0], c11[1], t.x);
+        windArray[k] = glm::vec3(glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z));
+#endif
+    }
+}
+
+}
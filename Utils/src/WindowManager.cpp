@@ -28,9 +28,7 @@ WindowManager::~WindowManager() {
     SDL_Quit();
 }
 
-float WindowManager::update() {
-    SDL_GL_SwapBuffers();
-
+float WindowManager::waitFrame() {
     Uint32 currentTime = SDL_GetTicks();
     Uint32 d = currentTime - m_nStartTime;
     if(d < m_nFrameDuration) {
@@ -0,0 +1,184 @@
+#include "Utils/renderer/FlagBatchRenderer3D.hpp"
+#include "Utils/renderer/GLState.hpp"
+#include "Utils/renderer/GLtools.hpp"
+#include "Utils/renderer/GridStrips.hpp"
+
+#include <stdexcept>
+
+namespace Utils {
+
+// gl_VertexID is the index in the grid, gl_InstanceID the flag
+const GLchar* FlagBatchRenderer3D::VERTEX_SHADER =
+"#version 330 core\n"
+GL_STRINGIFY(
+    layout(location = 0) in mat4 aModelMatrix;
+
+    uniform mat4 uVPMatrix;
+    uniform mat4 uViewMatrix;
+    uniform samplerBuffer uPositions;
+    uniform ivec2 uGridSize;
+
+    out vec3 vFragPosition;
+    out vec3 vFragNormal;
+
+    vec3 gridPosition(int i, int j) {
+        return texelFetch(uPositions, (gl_InstanceID * uGridSize.y + j) * uGridSize.x + i).xyz;
+    }
+
+    void main() {
+        int i = gl_VertexID % uGridSize.x;
+        int j = gl_VertexID / uGridSize.x;
+
+        vec3 dx = gridPosition(min(i + 1, uGridSize.x - 1), j) - gridPosition(max(i - 1, 0), j);
+        vec3 dy = gridPosition(i, min(j + 1, uGridSize.y - 1)) - gridPosition(i, max(j - 1, 0));
+
+        vec4 position = aModelMatrix * vec4(gridPosition(i, j), 1);
+        vFragPosition = vec3(uVPMatrix * position);
+        vFragNormal = vec3(uViewMatrix * aModelMatrix * vec4(cross(dx, dy), 0));
+        gl_Position = uVPMatrix * position;
+    }
+);
+
+const GLchar* FlagBatchRenderer3D::FRAGMENT_SHADER =
+"#version 330 core\n"
+GL_STRINGIFY(
+    in vec3 vFragPosition;
+    in vec3 vFragNormal;
+
+    out vec3 fFragColor;
+
+    void main() {
+        fFragColor = vec3(abs(dot(normalize(vFragPosition), normalize(vFragNormal))));
+    }
+);
+
+FlagBatchRenderer3D::FlagBatchRenderer3D(uint gridWidth, uint gridHeight, uint maxFlagCount):
+    m_ProgramID(buildProgram(VERTEX_SHADER, FRAGMENT_SHADER)),
+    m_ProjMatrix(1.f), m_ViewMatrix(1.f), m_bMatricesDirty(true),
+    m_nGridWidth(gridWidth), m_nGridHeight(gridHeight),
+    m_nMaxFlagCount(maxFlagCount), m_nIndexCount(0),
+    m_IndexType(gridWidth * gridHeight < 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT),
+    m_nRestartIndex(m_IndexType == GL_UNSIGNED_SHORT ? 0xFFFF : 0xFFFFFFFF),
+    m_nVertexSize(GLEW_ARB_texture_buffer_object_rgb32 ? sizeof(glm::vec3) : sizeof(glm::vec4)) {
+
+    GLint maxTexelCount = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexelCount);
+    if(GLint64(maxFlagCount) * gridWidth * gridHeight > maxTexelCount) {
+        throw std::runtime_error("Too many flags for a buffer texture");
+    }
+
+    // Positions, rewritten every frame
+    glGenBuffers(1, &m_PositionBufferID);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_PositionBufferID);
+    glBufferData(GL_TEXTURE_BUFFER, maxFlagCount * gridWidth * gridHeight * m_nVertexSize, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    GLState& state = GLState::current();
+    glGenTextures(1, &m_PositionTextureID);
+    state.activeTexture(GL_TEXTURE0);
+    state.bindTexture(GL_TEXTURE_BUFFER, m_PositionTextureID);
+    glTexBuffer(GL_TEXTURE_BUFFER, m_nVertexSize == sizeof(glm::vec3) ? GL_RGB32F : GL_RGBA32F, m_PositionBufferID);
+
+    // VAO: the strips of a single grid, and one model matrix per instance
+    glGenVertexArrays(1, &m_VAOID);
+    state.bindVertexArray(m_VAOID);
+
+    glGenBuffers(1, &m_IBOID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_IBOID);
+    std::vector<bool> noTornTriangles;
+    if(m_IndexType == GL_UNSIGNED_SHORT) {
+        std::vector<GLushort> indexBuffer;
+        buildGridStrips(gridWidth, gridHeight, noTornTriangles, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.size() * sizeof(GLushort), indexBuffer.data(), GL_STATIC_DRAW);
+        m_nIndexCount = indexBuffer.size();
+    } else {
+        std::vector<GLuint> indexBuffer;
+        buildGridStrips(gridWidth, gridHeight, noTornTriangles, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.size() * sizeof(GLuint), indexBuffer.data(), GL_STATIC_DRAW);
+        m_nIndexCount = indexBuffer.size();
+    }
+
+    glGenBuffers(1, &m_ModelMatrixBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, m_ModelMatrixBufferID);
+    glBufferData(GL_ARRAY_BUFFER, maxFlagCount * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+    for(GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(column);
+        glVertexAttribPointer(column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (const GLvoid*) (column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(column, 1);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    state.bindVertexArray(0);
+
+    m_uVPMatrix = glGetUniformLocation(m_ProgramID, "uVPMatrix");
+    m_uViewMatrix = glGetUniformLocation(m_ProgramID, "uViewMatrix");
+
+    state.useProgram(m_ProgramID);
+    glUniform1i(glGetUniformLocation(m_ProgramID, "uPositions"), 0);
+    glUniform2i(glGetUniformLocation(m_ProgramID, "uGridSize"), gridWidth, gridHeight);
+}
+
+FlagBatchRenderer3D::~FlagBatchRenderer3D() {
+    GLState& state = GLState::current();
+    state.deleteTexture(m_PositionTextureID);
+    glDeleteBuffers(1, &m_PositionBufferID);
+    glDeleteBuffers(1, &m_ModelMatrixBufferID);
+    glDeleteBuffers(1, &m_IBOID);
+    state.deleteVertexArray(m_VAOID);
+    state.deleteProgram(m_ProgramID);
+}
+
+void FlagBatchRenderer3D::drawFlags(const glm::vec3* const* positionArrays, const glm::mat4* modelMatrices, uint flagCount, bool wireframe) {
+    flagCount = glm::min(flagCount, m_nMaxFlagCount);
+    if(!flagCount) {
+        return;
+    }
+
+    const size_t vertexCount = m_nGridWidth * m_nGridHeight;
+
+    // The previous contents are invalidated: the driver does not wait for the last frame to write
+    glBindBuffer(GL_TEXTURE_BUFFER, m_PositionBufferID);
+    GLubyte* vertices = static_cast<GLubyte*>(glMapBufferRange(GL_TEXTURE_BUFFER, 0, flagCount * vertexCount * m_nVertexSize,
+                                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if(!vertices) {
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        return;
+    }
+    for(uint flag = 0; flag < flagCount; ++flag) {
+        for(size_t k = 0; k < vertexCount; ++k) {
+            *reinterpret_cast<glm::vec3*>(vertices + (flag * vertexCount + k) * m_nVertexSize) = positionArrays[flag][k];
+        }
+    }
+    glUnmapBuffer(GL_TEXTURE_BUFFER);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_ModelMatrixBufferID);
+    glBufferData(GL_ARRAY_BUFFER, m_nMaxFlagCount * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, flagCount * sizeof(glm::mat4), modelMatrices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLState& state = GLState::current();
+    state.enable(GLState::DEPTH_TEST);
+
+    state.useProgram(m_ProgramID);
+
+    if(m_bMatricesDirty) {
+        glUniformMatrix4fv(m_uVPMatrix, 1, GL_FALSE, glm::value_ptr(m_ProjMatrix * m_ViewMatrix));
+        glUniformMatrix4fv(m_uViewMatrix, 1, GL_FALSE, glm::value_ptr(m_ViewMatrix));
+        m_bMatricesDirty = false;
+    }
+
+    state.polygonMode(wireframe ? GL_LINE : GL_FILL);
+
+    state.activeTexture(GL_TEXTURE0);
+    state.bindTexture(GL_TEXTURE_BUFFER, m_PositionTextureID);
+
+    state.enable(GLState::PRIMITIVE_RESTART);
+    state.primitiveRestartIndex(m_nRestartIndex);
+
+    state.bindVertexArray(m_VAOID);
+    glDrawElementsInstanced(GL_TRIANGLE_STRIP, m_nIndexCount, m_IndexType, 0, flagCount);
+    state.bindVertexArray(0);
+}
+
+}
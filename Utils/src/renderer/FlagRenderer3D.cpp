@@ -1,8 +1,13 @@
 #include "Utils/renderer/FlagRenderer3D.hpp"
+#include "Utils/renderer/GLState.hpp"
 #include "Utils/renderer/GLtools.hpp"
+#include "Utils/renderer/GridStrips.hpp"
 #include "Utils/glm.hpp"
+#include "Utils/Parallel.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
 namespace Utils {
 
@@ -25,6 +30,70 @@ GL_STRINGIFY(
     }
 );
 
+// Positions stored as offset + scale * aVertexPosition, normals octahedral-encoded
+const GLchar* FlagRenderer3D::COMPACT_VERTEX_SHADER =
+"#version 330 core\n"
+GL_STRINGIFY(
+    layout(location = 0) in vec3 aVertexPosition;
+    layout(location = 1) in vec2 aVertexNormal;
+
+    uniform mat4 uMVPMatrix;
+    uniform mat4 uMVMatrix;
+    uniform vec3 uPositionOffset;
+    uniform vec3 uPositionScale;
+
+    out vec3 vFragPosition;
+    out vec3 vFragNormal;
+
+    vec3 decodeNormal(vec2 e) {
+        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+        if(n.z < 0.0) {
+            n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        }
+        return normalize(n);
+    }
+
+    void main() {
+        vec4 position = vec4(uPositionOffset + uPositionScale * aVertexPosition, 1);
+        vFragPosition = vec3(uMVPMatrix * position);
+        vFragNormal = vec3(uMVMatrix * vec4(decodeNormal(aVertexNormal), 0));
+        gl_Position = uMVPMatrix * position;
+    }
+);
+
+// Positions fetched from a buffer texture by vertex index, the normal being the cross
+// product of the central differences along the rows and the columns of the grid
+const GLchar* FlagRenderer3D::POSITION_ONLY_VERTEX_SHADER =
+"#version 330 core\n"
+GL_STRINGIFY(
+    uniform mat4 uMVPMatrix;
+    uniform mat4 uMVMatrix;
+    uniform samplerBuffer uPositions;
+    uniform int uFirstVertex;
+    uniform ivec2 uGridSize;
+
+    out vec3 vFragPosition;
+    out vec3 vFragNormal;
+
+    vec3 gridPosition(int i, int j) {
+        return texelFetch(uPositions, uFirstVertex + i + j * uGridSize.x).xyz;
+    }
+
+    void main() {
+        int i = gl_VertexID % uGridSize.x;
+        int j = gl_VertexID / uGridSize.x;
+
+        vec3 dx = gridPosition(min(i + 1, uGridSize.x - 1), j) - gridPosition(max(i - 1, 0), j);
+        vec3 dy = gridPosition(i, min(j + 1, uGridSize.y - 1)) - gridPosition(i, max(j - 1, 0));
+        vec3 normal = cross(dx, dy);
+
+        vec4 position = vec4(gridPosition(i, j), 1);
+        vFragPosition = vec3(uMVPMatrix * position);
+        vFragNormal = vec3(uMVMatrix * vec4(normal, 0));
+        gl_Position = uMVPMatrix * position;
+    }
+);
+
 const GLchar* FlagRenderer3D::FRAGMENT_SHADER =
 "#version 330 core\n"
 GL_STRINGIFY(
@@ -38,190 +107,438 @@ GL_STRINGIFY(
     }
 );
 
-FlagRenderer3D::FlagRenderer3D(uint gridWidth, uint gridHeight):
-    m_ProgramID(buildProgram(VERTEX_SHADER, FRAGMENT_SHADER)),
-    m_ProjMatrix(1.f), m_ViewMatrix(1.f),
-    m_nGridWidth(gridWidth), m_nGridHeight(gridHeight), m_nIndexCount(0),
-    m_VertexBuffer(gridWidth * gridHeight) {
+// Octahedral encoding of a unit vector, in two snorm16
+static GLuint packNormal(const glm::vec3& n) {
+    float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if(l1 == 0.f) {
+        return 0;
+    }
+
+    glm::vec2 e = glm::vec2(n) / l1;
+    if(n.z < 0.f) {
+        e = (1.f - glm::abs(glm::vec2(e.y, e.x))) * glm::vec2(e.x >= 0.f ? 1.f : -1.f, e.y >= 0.f ? 1.f : -1.f);
+    }
+    return glm::packSnorm2x16(e);
+}
+
+// Quads drawn smaller than this are merged by the next level of detail
+static const float LEVEL_OF_DETAIL_QUAD_PIXELS = 4.f;
+
+// Buffer textures are only required to hold 65536 texels, which the ring of a large grid may exceed
+static VertexFormat supportedVertexFormat(VertexFormat vertexFormat, GLint vertexCount) {
+    if(vertexFormat == VERTEX_POSITION_ONLY) {
+        GLint maxTexelCount = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexelCount);
+        if(maxTexelCount < vertexCount) {
+            std::cerr << "Grid too large for a buffer texture, falling back to the full vertex format" << std::endl;
+            return VERTEX_FULL;
+        }
+    }
+    return vertexFormat;
+}
+
+static GLsizei vertexSize(VertexFormat vertexFormat) {
+    switch(vertexFormat) {
+    case VERTEX_PACKED_NORMAL:
+        return sizeof(glm::vec3) + sizeof(GLuint);
+    case VERTEX_COMPACT:
+        return 4 * sizeof(GLushort) + sizeof(GLuint);
+    case VERTEX_POSITION_ONLY:
+        return GLEW_ARB_texture_buffer_object_rgb32 ? sizeof(glm::vec3) : sizeof(glm::vec4);
+    default:
+        return 2 * sizeof(glm::vec3);
+    }
+}
+
+FlagRenderer3D::FlagRenderer3D(uint gridWidth, uint gridHeight, VertexFormat vertexFormat):
+    m_ProgramID(0), m_PositionTextureID(0),
+    m_ProjMatrix(1.f), m_ViewMatrix(1.f), m_bMatricesDirty(true),
+    m_nGridWidth(gridWidth), m_nGridHeight(gridHeight),
+    m_nLevelOfDetail(0),
+    m_IndexType(gridWidth * gridHeight < 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT),
+    m_nRestartIndex(m_IndexType == GL_UNSIGNED_SHORT ? 0xFFFF : 0xFFFFFFFF),
+    m_VertexFormat(supportedVertexFormat(vertexFormat, RING_SECTION_COUNT * gridWidth * gridHeight)),
+    m_nVertexSize(vertexSize(m_VertexFormat)),
+    m_nVertexCount(gridWidth * gridHeight), m_VertexBuffer(m_nVertexCount * m_nVertexSize),
+    m_PositionOffset(0.f), m_PositionScale(1.f),
+    m_pMappedVertices(nullptr), m_SectionFences(), m_nSection(0) {
+
+    const GLchar* vertexShader = m_VertexFormat == VERTEX_FULL ? VERTEX_SHADER :
+                                 m_VertexFormat == VERTEX_POSITION_ONLY ? POSITION_ONLY_VERTEX_SHADER : COMPACT_VERTEX_SHADER;
+    m_ProgramID = buildProgram(vertexShader, FRAGMENT_SHADER);
+
+    // VBO: a ring of frames mapped once for all and written in place, so that a frame
+    // is neither copied by the driver nor waits for the GPU to release the previous one
+    const GLsizeiptr frameSize = m_VertexBuffer.size();
+    const GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
-    // VBO
     glGenBuffers(1, &m_VBOID);
     glBindBuffer(GL_ARRAY_BUFFER, m_VBOID);
 
-    glGenBuffers(1, &m_IBOID);
+    if(GLEW_ARB_buffer_storage) {
+        glBufferStorage(GL_ARRAY_BUFFER, RING_SECTION_COUNT * frameSize, nullptr, mapFlags);
+        m_pMappedVertices = static_cast<GLubyte*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, RING_SECTION_COUNT * frameSize, mapFlags));
 
-    std::vector<GLuint> indexBuffer;
-    for(int j = 0; j < gridHeight - 1; ++j) {
-        for(int i = 0; i < gridWidth - 1; ++i) {
-            indexBuffer.push_back(i + j * gridWidth);
-            indexBuffer.push_back((i + 1) + j * gridWidth);
-            indexBuffer.push_back((i + 1) + (j + 1) * gridWidth);
-            indexBuffer.push_back(i + j * gridWidth);
-            indexBuffer.push_back((i + 1) + (j + 1) * gridWidth);
-            indexBuffer.push_back(i + (j + 1) * gridWidth);
+        if(!m_pMappedVertices) {
+            // The storage is immutable, start again with a new buffer
+            std::cerr << "Unable to map the vertex buffer, falling back to glBufferSubData" << std::endl;
+            glDeleteBuffers(1, &m_VBOID);
+            glGenBuffers(1, &m_VBOID);
+            glBindBuffer(GL_ARRAY_BUFFER, m_VBOID);
         }
     }
-    m_nIndexCount = indexBuffer.size();
+
+    // Fallback: a single frame, orphaned before each upload
+    if(!m_pMappedVertices) {
+        glBufferData(GL_ARRAY_BUFFER, frameSize, nullptr, GL_STREAM_DRAW);
+    }
+
+    glGenBuffers(1, &m_IBOID);
 
     // VAO
+    GLState& state = GLState::current();
     glGenVertexArrays(1, &m_VAOID);
-    glBindVertexArray(m_VAOID);
+    state.bindVertexArray(m_VAOID);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_IBOID);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.size() * sizeof(indexBuffer[0]), indexBuffer.data(), GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*) offsetof(Vertex, position));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*) offsetof(Vertex, normal));
+    uploadIndices();
+
+    switch(m_VertexFormat) {
+    case VERTEX_FULL:
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, m_nVertexSize, (const GLvoid*) offsetof(Vertex, position));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, m_nVertexSize, (const GLvoid*) offsetof(Vertex, normal));
+        break;
+    case VERTEX_PACKED_NORMAL:
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, m_nVertexSize, (const GLvoid*) offsetof(PackedNormalVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, m_nVertexSize, (const GLvoid*) offsetof(PackedNormalVertex, normal));
+        break;
+    case VERTEX_COMPACT:
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, m_nVertexSize, (const GLvoid*) offsetof(CompactVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, m_nVertexSize, (const GLvoid*) offsetof(CompactVertex, normal));
+        break;
+    case VERTEX_POSITION_ONLY:
+        // No attribute, the vertex shader fetches the positions by gl_VertexID
+        glGenTextures(1, &m_PositionTextureID);
+        state.activeTexture(GL_TEXTURE0);
+        state.bindTexture(GL_TEXTURE_BUFFER, m_PositionTextureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, m_nVertexSize == sizeof(glm::vec3) ? GL_RGB32F : GL_RGBA32F, m_VBOID);
+        break;
+    }
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    state.bindVertexArray(0);
 
     m_uMVPMatrix = glGetUniformLocation(m_ProgramID, "uMVPMatrix");
     m_uMVMatrix = glGetUniformLocation(m_ProgramID, "uMVMatrix");
+    m_uPositionOffset = glGetUniformLocation(m_ProgramID, "uPositionOffset");
+    m_uPositionScale = glGetUniformLocation(m_ProgramID, "uPositionScale");
+    m_uFirstVertex = glGetUniformLocation(m_ProgramID, "uFirstVertex");
+
+    state.useProgram(m_ProgramID);
+    glUniform1i(glGetUniformLocation(m_ProgramID, "uPositions"), 0);
+    glUniform2i(glGetUniformLocation(m_ProgramID, "uGridSize"), gridWidth, gridHeight);
+    // The packed format shares the compact vertex shader with unquantised positions
+    glUniform3fv(m_uPositionOffset, 1, glm::value_ptr(m_PositionOffset));
+    glUniform3fv(m_uPositionScale, 1, glm::value_ptr(m_PositionScale));
 }
 
 FlagRenderer3D::~FlagRenderer3D() {
+    for(GLsync fence : m_SectionFences) {
+        glDeleteSync(fence);
+    }
+    GLState& state = GLState::current();
+    state.deleteTexture(m_PositionTextureID);
     glDeleteBuffers(1, &m_VBOID);
     glDeleteBuffers(1, &m_IBOID);
-    glDeleteVertexArrays(1, &m_VAOID);
-    glDeleteProgram(m_ProgramID);
+    state.deleteVertexArray(m_VAOID);
+    state.deleteProgram(m_ProgramID);
 }
 
 void FlagRenderer3D::clear() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
-void FlagRenderer3D::drawGrid(const glm::vec3* positionArray, bool wireframe) {
-    glEnable(GL_DEPTH_TEST);
-
-    glBindBuffer(GL_ARRAY_BUFFER, m_VBOID);
+void FlagRenderer3D::removeTriangles(const uint* triangleArray, size_t count) {
+    // The packed rows have no room to grow: the first tear gives each row its slot
+    const bool packed = m_TornTriangleArray.empty();
+    if(packed) {
+        m_TornTriangleArray.resize(2 * (m_nGridWidth - 1) * (m_nGridHeight - 1), false);
+    }
 
-    for(int j = 0; j < m_nGridHeight; ++j) {
-        for(int i = 0; i < m_nGridWidth; ++i) {
-            m_VertexBuffer[i + j * m_nGridWidth].position = positionArray[i + j * m_nGridWidth];
-            
-            glm::vec3 N(0.f);
+    // Rows of each level holding a newly torn triangle, the only ones rewritten
+    std::vector<int> dirtyRows[LEVEL_OF_DETAIL_COUNT];
+    for(size_t k = 0; k < count; ++k) {
+        if(m_TornTriangleArray[triangleArray[k]]) {
+            continue;
+        }
+        m_TornTriangleArray[triangleArray[k]] = true;
 
-            glm::vec3 A = positionArray[i + j * m_nGridWidth];
+        const int j = triangleArray[k] / 2 / (m_nGridWidth - 1);
+        for(uint32_t level = 0; level < LEVEL_OF_DETAIL_COUNT; ++level) {
+            dirtyRows[level].push_back(gridStripRow(j, 1 << level));
+        }
+    }
+    for(std::vector<int>& rows : dirtyRows) {
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    }
 
-            if(i > 0 && j > 0) {
-                glm::vec3 B = positionArray[(i - 1) + j * m_nGridWidth];
-                glm::vec3 C = positionArray[(i - 1) + (j - 1) * m_nGridWidth];
+    // The IBO is bound to the VAO
+    GLState& state = GLState::current();
+    state.bindVertexArray(m_VAOID);
+    if(packed) {
+        uploadIndices();
+    } else if(m_IndexType == GL_UNSIGNED_SHORT) {
+        uploadIndexRows<GLushort>(dirtyRows);
+    } else {
+        uploadIndexRows<GLuint>(dirtyRows);
+    }
+    state.bindVertexArray(0);
+}
 
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
+void FlagRenderer3D::uploadIndices() {
+    if(m_IndexType == GL_UNSIGNED_SHORT) {
+        uploadIndices<GLushort>();
+    } else {
+        uploadIndices<GLuint>();
+    }
+}
 
-                if(l > 0.0001f) {
-                    N += BxC / l;
-                }
+template<typename Index>
+void FlagRenderer3D::uploadIndices() {
+    const Index restartIndex = std::numeric_limits<Index>::max();
+    const bool slots = !m_TornTriangleArray.empty();
+    std::vector<Index> indexBuffer;
+
+    for(uint32_t level = 0; level < LEVEL_OF_DETAIL_COUNT; ++level) {
+        const int step = 1 << level, rowCount = gridStripRowCount(m_nGridHeight, step);
+        const size_t rowCapacity = gridStripRowCapacity(m_nGridWidth, step);
+        m_RowIndexCounts[level].resize(rowCount);
+        m_RowIndexOffsets[level].resize(rowCount);
+
+        for(int r = 0; r < rowCount; ++r) {
+            const size_t slot = indexBuffer.size();
+            buildGridStripRow(m_nGridWidth, m_nGridHeight, m_TornTriangleArray, r, indexBuffer, step);
+            m_RowIndexCounts[level][r] = indexBuffer.size() - slot;
+            m_RowIndexOffsets[level][r] = (const GLvoid*) (slot * sizeof(Index));
+            if(slots) {
+                indexBuffer.resize(slot + rowCapacity, restartIndex);
             }
+        }
+        updateDrawRows(level);
+    }
+    m_RowBaseVertices.assign(m_RowIndexCounts[0].size(), 0);
 
-            if(i > 0 && j > 0) {
-                glm::vec3 B = positionArray[(i - 1) + (j - 1) * m_nGridWidth];
-                glm::vec3 C = positionArray[i + (j - 1) * m_nGridWidth];
-
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.size() * sizeof(Index), indexBuffer.data(), GL_DYNAMIC_DRAW);
+}
 
-                if(l > 0.0001f) {
-                    N += BxC / l;
-                }
-            }
+template<typename Index>
+void FlagRenderer3D::uploadIndexRows(const std::vector<int>* dirtyRows) {
+    std::vector<Index> indexBuffer;
 
-            if(i < m_nGridWidth - 1 && j > 0) {
-                glm::vec3 B = positionArray[i + (j - 1) * m_nGridWidth];
-                glm::vec3 C = positionArray[(i + 1) + (j - 1) * m_nGridWidth];
+    for(uint32_t level = 0; level < LEVEL_OF_DETAIL_COUNT; ++level) {
+        for(int r : dirtyRows[level]) {
+            indexBuffer.clear();
+            buildGridStripRow(m_nGridWidth, m_nGridHeight, m_TornTriangleArray, r, indexBuffer, 1 << level);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr) m_RowIndexOffsets[level][r], indexBuffer.size() * sizeof(Index), indexBuffer.data());
+            m_RowIndexCounts[level][r] = indexBuffer.size();
+        }
+        if(!dirtyRows[level].empty()) {
+            updateDrawRows(level);
+        }
+    }
+}
 
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
+void FlagRenderer3D::updateDrawRows(uint32_t level) {
+    m_DrawIndexCounts[level].clear();
+    m_DrawIndexOffsets[level].clear();
+    for(size_t r = 0; r < m_RowIndexCounts[level].size(); ++r) {
+        if(m_RowIndexCounts[level][r]) {
+            m_DrawIndexCounts[level].push_back(m_RowIndexCounts[level][r]);
+            m_DrawIndexOffsets[level].push_back(m_RowIndexOffsets[level][r]);
+        }
+    }
+}
 
-                if(l > 0.0001f) {
-                    N += BxC / l;
-                }
-            }
+uint FlagRenderer3D::selectLevelOfDetail(float quadSize, float distance, uint viewportHeight) const {
+    // Height in pixels of a quad facing the camera
+    float quadPixels = 0.5f * viewportHeight * m_ProjMatrix[1][1] * quadSize / glm::max(distance, 1e-3f);
 
-            if(i < m_nGridWidth - 1 && j > 0) {
-                glm::vec3 B = positionArray[(i + 1) + (j - 1) * m_nGridWidth];
-                glm::vec3 C = positionArray[(i + 1) + j * m_nGridWidth];
+    uint level = 0;
+    while(level + 1 < LEVEL_OF_DETAIL_COUNT && quadPixels < LEVEL_OF_DETAIL_QUAD_PIXELS) {
+        quadPixels *= 2.f;
+        ++level;
+    }
+    return level;
+}
 
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
+void FlagRenderer3D::drawGrid(const glm::vec3* positionArray, bool wireframe) {
+    if(m_VertexFormat != VERTEX_POSITION_ONLY) {
+        m_Normals.computeFaceNormals(positionArray, m_nGridWidth, m_nGridHeight);
+    }
+    drawGrid(positionArray, m_Normals, wireframe);
+}
 
-                if(l > 0.0001f) {
-                    N += BxC / l;
-                }
-            }
+void FlagRenderer3D::drawGrid(const glm::vec3* positionArray, FlagNormals& normals, bool wireframe) {
+    // The normals are only gathered if they are uploaded
+    const glm::vec3* normalArray = m_VertexFormat != VERTEX_POSITION_ONLY ? normals.getVertexNormals().data() : nullptr;
 
-            if(i < m_nGridWidth - 1 && j < m_nGridHeight - 1) {
-                glm::vec3 B = positionArray[(i + 1) + j * m_nGridWidth];
-                glm::vec3 C = positionArray[(i + 1) + (j + 1) * m_nGridWidth];
+    GLubyte* vertices = beginVertices();
 
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
+    // Bands of rows per thread, each writing its own contiguous range of the mapped buffer
+    const int w = m_nGridWidth, h = m_nGridHeight;
 
-                if(l > 0.0001f) {
-                    N += BxC / l;
+    switch(m_VertexFormat) {
+    case VERTEX_FULL:
+        #pragma omp parallel for if(w * h >= PARALLEL_VERTEX_COUNT)
+        for(int j = 0; j < h; ++j) {
+            for(int k = j * w; k < (j + 1) * w; ++k) {
+                Vertex& vertex = reinterpret_cast<Vertex*>(vertices)[k];
+                vertex.position = positionArray[k];
+                vertex.normal = normalArray[k];
+            }
+        }
+        break;
+
+    case VERTEX_PACKED_NORMAL:
+        #pragma omp parallel for if(w * h >= PARALLEL_VERTEX_COUNT)
+        for(int j = 0; j < h; ++j) {
+            for(int k = j * w; k < (j + 1) * w; ++k) {
+                PackedNormalVertex& vertex = reinterpret_cast<PackedNormalVertex*>(vertices)[k];
+                vertex.position = positionArray[k];
+                vertex.normal = packNormal(normalArray[k]);
+            }
+        }
+        break;
+
+    case VERTEX_COMPACT: {
+        // Bounding box of the frame, 16 bits over it. Each thread bounds its rows first.
+        glm::vec3 minPosition = positionArray[0], maxPosition = positionArray[0];
+        #pragma omp parallel if(w * h >= PARALLEL_VERTEX_COUNT)
+        {
+            glm::vec3 threadMin = positionArray[0], threadMax = positionArray[0];
+            #pragma omp for nowait
+            for(int j = 0; j < h; ++j) {
+                for(int k = j * w; k < (j + 1) * w; ++k) {
+                    threadMin = glm::min(threadMin, positionArray[k]);
+                    threadMax = glm::max(threadMax, positionArray[k]);
                 }
             }
+            #pragma omp critical
+            {
+                minPosition = glm::min(minPosition, threadMin);
+                maxPosition = glm::max(maxPosition, threadMax);
+            }
+        }
+        m_PositionOffset = minPosition;
+        m_PositionScale = glm::max(maxPosition - minPosition, glm::vec3(1e-6f));
+        const glm::vec3 quantisationScale = 65535.f / m_PositionScale, positionOffset = m_PositionOffset;
+
+        #pragma omp parallel for if(w * h >= PARALLEL_VERTEX_COUNT)
+        for(int j = 0; j < h; ++j) {
+            for(int k = j * w; k < (j + 1) * w; ++k) {
+                CompactVertex& vertex = reinterpret_cast<CompactVertex*>(vertices)[k];
+                glm::vec3 position = (positionArray[k] - positionOffset) * quantisationScale + 0.5f;
+                vertex.position[0] = GLushort(position.x);
+                vertex.position[1] = GLushort(position.y);
+                vertex.position[2] = GLushort(position.z);
+                vertex.position[3] = 0;
+                vertex.normal = packNormal(normalArray[k]);
+            }
+        }
+        break;
+    }
 
-            if(i < m_nGridWidth - 1 && j < m_nGridHeight - 1) {
-                glm::vec3 B = positionArray[(i + 1) + (j + 1) * m_nGridWidth];
-                glm::vec3 C = positionArray[i + (j + 1) * m_nGridWidth];
-
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
-
-                if(l > 0.0001f) {
-                    N += BxC / l;
-                }
+    case VERTEX_POSITION_ONLY:
+        #pragma omp parallel for if(w * h >= PARALLEL_VERTEX_COUNT)
+        for(int j = 0; j < h; ++j) {
+            for(int k = j * w; k < (j + 1) * w; ++k) {
+                *reinterpret_cast<glm::vec3*>(vertices + k * m_nVertexSize) = positionArray[k];
             }
+        }
+        break;
+    }
+
+    draw(wireframe);
+}
 
-            if(i > 0 && j < m_nGridHeight - 1) {
-                glm::vec3 B = positionArray[i + (j + 1) * m_nGridWidth];
-                glm::vec3 C = positionArray[(i - 1) + (j + 1) * m_nGridWidth];
+GLubyte* FlagRenderer3D::beginVertices() {
+    if(!m_pMappedVertices) {
+        return m_VertexBuffer.data();
+    }
 
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
+    m_nSection = (m_nSection + 1) % RING_SECTION_COUNT;
 
-                if(l > 0.0001f) {
-                    N += BxC / l;
-                }
-            }
+    // Wait for the GPU to be done with the frame drawn RING_SECTION_COUNT frames ago
+    GLsync& fence = m_SectionFences[m_nSection];
+    if(fence) {
+        while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        fence = 0;
+    }
+    return m_pMappedVertices + m_nSection * m_VertexBuffer.size();
+}
 
-            if(i > 0 && j < m_nGridHeight - 1) {
-                glm::vec3 B = positionArray[(i - 1) + (j + 1) * m_nGridWidth];
-                glm::vec3 C = positionArray[(i - 1) + j * m_nGridWidth];
+void FlagRenderer3D::draw(bool wireframe) {
+    GLState& state = GLState::current();
+    state.enable(GLState::DEPTH_TEST);
 
-                glm::vec3 BxC = glm::cross(B - A, C - A);
-                float l = glm::length(BxC);
+    if(!m_pMappedVertices) {
+        glBindBuffer(GL_ARRAY_BUFFER, m_VBOID);
+        glBufferData(GL_ARRAY_BUFFER, m_VertexBuffer.size(), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, m_VertexBuffer.size(), m_VertexBuffer.data());
+    }
 
-                if(l > 0.0001f) {
-                    N += BxC / l;
-                }
-            }
+    state.useProgram(m_ProgramID);
 
-            m_VertexBuffer[i + j * m_nGridWidth].normal = N != glm::vec3(0.f) ? glm::normalize(N) : glm::vec3(0.f);
-        }
+    // Uniforms belong to the program: only what changed since the last draw is uploaded
+    if(m_bMatricesDirty) {
+        glUniformMatrix4fv(m_uMVPMatrix, 1, GL_FALSE, glm::value_ptr(m_ProjMatrix * m_ViewMatrix));
+        glUniformMatrix4fv(m_uMVMatrix, 1, GL_FALSE, glm::value_ptr(m_ViewMatrix));
+        m_bMatricesDirty = false;
+    }
+    if(m_VertexFormat == VERTEX_COMPACT) {
+        glUniform3fv(m_uPositionOffset, 1, glm::value_ptr(m_PositionOffset));
+        glUniform3fv(m_uPositionScale, 1, glm::value_ptr(m_PositionScale));
     }
 
-    glBufferData(GL_ARRAY_BUFFER, m_VertexBuffer.size() * sizeof(m_VertexBuffer[0]), m_VertexBuffer.data(), GL_DYNAMIC_DRAW);
+    state.polygonMode(wireframe ? GL_LINE : GL_FILL);
 
-    glUseProgram(m_ProgramID);
+    // The section of the ring is selected by the base vertex, or by the first texel
+    // of the buffer texture, gl_VertexID being the index alone for the shader
+    GLint baseVertex = m_pMappedVertices ? m_nSection * m_nVertexCount : 0;
+    if(m_VertexFormat == VERTEX_POSITION_ONLY) {
+        glUniform1i(m_uFirstVertex, baseVertex);
+        state.activeTexture(GL_TEXTURE0);
+        state.bindTexture(GL_TEXTURE_BUFFER, m_PositionTextureID);
+        baseVertex = 0;
+    }
 
-    glUniformMatrix4fv(m_uMVPMatrix, 1, GL_FALSE, glm::value_ptr(m_ProjMatrix * m_ViewMatrix));
-    glUniformMatrix4fv(m_uMVMatrix, 1, GL_FALSE, glm::value_ptr(m_ViewMatrix));
+    state.enable(GLState::PRIMITIVE_RESTART);
+    state.primitiveRestartIndex(m_nRestartIndex);
 
-    if(wireframe) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    } else {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    // Rows of the level of detail in the IBO, each one drawn from where it starts
+    const std::vector<GLsizei>& drawIndexCounts = m_DrawIndexCounts[m_nLevelOfDetail];
+    if(m_RowBaseVertices[0] != baseVertex) {
+        std::fill(m_RowBaseVertices.begin(), m_RowBaseVertices.end(), baseVertex);
     }
 
-    glBindVertexArray(m_VAOID);
-        glDrawElements(GL_TRIANGLES, m_nIndexCount, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    state.bindVertexArray(m_VAOID);
+    if(!drawIndexCounts.empty()) {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, drawIndexCounts.data(), m_IndexType, m_DrawIndexOffsets[m_nLevelOfDetail].data(),
+                                      drawIndexCounts.size(), m_RowBaseVertices.data());
+    }
+    state.bindVertexArray(0);
+
+    if(m_pMappedVertices) {
+        m_SectionFences[m_nSection] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
 }
 
 }
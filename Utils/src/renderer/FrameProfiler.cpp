@@ -0,0 +1,118 @@
+#include "Utils/renderer/FrameProfiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace Utils {
+
+// Weight of the last frame in the displayed times
+static const float SMOOTHING = 0.1f;
+
+// Left out of the times: the first frame pays for shader compilation and initial uploads,
+// and some drivers return a meaningless value for the first query of a context
+static const uint32_t WARMUP_FRAME_COUNT = 1;
+
+FrameProfiler::FrameProfiler(const std::vector<std::string>& passNames):
+    m_PassNames(passNames), m_bTimerQueries(GLEW_ARB_timer_query),
+    m_QueryIDs(2 * passNames.size(), 0), m_QueryIssued(2 * passNames.size(), false), m_nParity(0),
+    m_FrameCPUTimes(passNames.size(), 0.f), m_nFrameIndex(0),
+    m_CPUTimes(passNames.size(), 0.f), m_GPUTimes(passNames.size(), 0.f),
+    m_fCPUTotal(0.f), m_fGPUTotal(0.f),
+    m_CPUSums(passNames.size(), 0.), m_GPUSums(passNames.size(), 0.),
+    m_nFrameCount(0), m_GPUSampleCounts(passNames.size(), 0) {
+
+    if(m_bTimerQueries) {
+        glGenQueries(m_QueryIDs.size(), m_QueryIDs.data());
+    }
+}
+
+FrameProfiler::~FrameProfiler() {
+    if(m_bTimerQueries) {
+        glDeleteQueries(m_QueryIDs.size(), m_QueryIDs.data());
+    }
+}
+
+void FrameProfiler::begin(uint32_t pass) {
+    if(m_bTimerQueries) {
+        glBeginQuery(GL_TIME_ELAPSED, m_QueryIDs[2 * pass + m_nParity]);
+    }
+    m_PassStart = Clock::now();
+}
+
+void FrameProfiler::end(uint32_t pass) {
+    m_FrameCPUTimes[pass] = std::chrono::duration<float, std::milli>(Clock::now() - m_PassStart).count();
+    if(m_bTimerQueries) {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_QueryIssued[2 * pass + m_nParity] = true;
+    }
+}
+
+void FrameProfiler::endFrame() {
+    const uint32_t passCount = m_PassNames.size();
+    const uint32_t frame = m_nFrameIndex++;
+
+    if(frame >= WARMUP_FRAME_COUNT) {
+        m_fCPUTotal = 0.f;
+        for(uint32_t pass = 0; pass < passCount; ++pass) {
+            m_CPUTimes[pass] += SMOOTHING * (m_FrameCPUTimes[pass] - m_CPUTimes[pass]);
+            m_CPUSums[pass] += m_FrameCPUTimes[pass];
+            m_fCPUTotal += m_CPUTimes[pass];
+        }
+        ++m_nFrameCount;
+    }
+    std::fill(m_FrameCPUTimes.begin(), m_FrameCPUTimes.end(), 0.f);
+
+    if(!m_bTimerQueries) {
+        return;
+    }
+
+    // The other set was issued during the previous frame
+    m_nParity = 1 - m_nParity;
+    const bool sampled = frame >= WARMUP_FRAME_COUNT + 1;
+
+    m_fGPUTotal = 0.f;
+    for(uint32_t pass = 0; pass < passCount; ++pass) {
+        const uint32_t query = 2 * pass + m_nParity;
+        float time = 0.f;
+        if(m_QueryIssued[query]) {
+            GLint available = GL_FALSE;
+            glGetQueryObjectiv(m_QueryIDs[query], GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available) {
+                // Still in flight: the sample is dropped rather than waited for
+                m_fGPUTotal += m_GPUTimes[pass];
+                continue;
+            }
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(m_QueryIDs[query], GL_QUERY_RESULT, &nanoseconds);
+            time = nanoseconds * 1e-6f;
+            m_QueryIssued[query] = false;
+        }
+        if(!sampled) {
+            continue;
+        }
+        m_GPUTimes[pass] += SMOOTHING * (time - m_GPUTimes[pass]);
+        m_GPUSums[pass] += time;
+        ++m_GPUSampleCounts[pass];
+        m_fGPUTotal += m_GPUTimes[pass];
+    }
+}
+
+void FrameProfiler::printSummary(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << "Average per frame over " << m_nFrameCount << " frames (ms):" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for(uint32_t pass = 0; pass < m_PassNames.size(); ++pass) {
+        out << "  " << std::left << std::setw(12) << m_PassNames[pass] << std::right
+            << " CPU " << std::setw(8) << (m_nFrameCount ? m_CPUSums[pass] / m_nFrameCount : 0.);
+        if(m_bTimerQueries) {
+            out << "  GPU " << std::setw(8) << (m_GPUSampleCounts[pass] ? m_GPUSums[pass] / m_GPUSampleCounts[pass] : 0.);
+        }
+        out << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}
@@ -0,0 +1,67 @@
+#include "Utils/renderer/FrameReader.hpp"
+
+#include <cstring>
+
+namespace Utils {
+
+FrameReader::FrameReader(ImageSequenceWriter& writer):
+    m_Writer(writer), m_Fences(), m_nNextSlot(0) {
+
+    const GLsizeiptr frameSize = writer.getWidth() * writer.getHeight() * 4;
+
+    glGenBuffers(RING_SIZE, m_PBOIDs);
+    for(GLuint pbo : m_PBOIDs) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameSize, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameReader::~FrameReader() {
+    flush();
+    glDeleteBuffers(RING_SIZE, m_PBOIDs);
+}
+
+void FrameReader::readFrame() {
+    // The oldest frame is in the slot about to be reused
+    if(m_Fences[m_nNextSlot]) {
+        collect(m_nNextSlot);
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOIDs[m_nNextSlot]);
+    glReadPixels(0, 0, m_Writer.getWidth(), m_Writer.getHeight(), GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_Fences[m_nNextSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    m_nNextSlot = (m_nNextSlot + 1) % RING_SIZE;
+}
+
+void FrameReader::flush() {
+    for(uint32_t k = 0; k < RING_SIZE; ++k) {
+        uint32_t slot = (m_nNextSlot + k) % RING_SIZE;
+        if(m_Fences[slot]) {
+            collect(slot);
+        }
+    }
+}
+
+void FrameReader::collect(uint32_t slot) {
+    while(glClientWaitSync(m_Fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(m_Fences[slot]);
+    m_Fences[slot] = 0;
+
+    std::vector<uint8_t> pixels = m_Writer.takeBuffer();
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOIDs[slot]);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels.size(), GL_MAP_READ_BIT);
+    if(mapped) {
+        memcpy(pixels.data(), mapped, pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    m_Writer.addFrame(std::move(pixels));
+}
+
+}
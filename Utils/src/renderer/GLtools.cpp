@@ -1,10 +1,133 @@
 #include "Utils/renderer/GLtools.hpp"
 
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace Utils {
 
+static std::string programCacheDirectory;
+static bool programCacheEnabled = false;
+
+void setProgramCacheDirectory(const char* directory) {
+    programCacheEnabled = directory != nullptr;
+    programCacheDirectory = directory ? directory : "";
+}
+
+// FNV-1a
+static void hashString(uint64_t& hash, const char* string) {
+    for(const char* c = string; c && *c; ++c) {
+        hash ^= uint8_t(*c);
+        hash *= 1099511628211ull;
+    }
+    // Separator, so that moving text from a string to the next changes the hash
+    hash *= 1099511628211ull;
+}
+
+// Binaries are only valid for the driver which produced them
+static std::string programCachePath(const GLchar* vertexShaderSource, const GLchar* fragmentShaderSource) {
+    uint64_t hash = 14695981039346656037ull;
+    hashString(hash, vertexShaderSource);
+    hashString(hash, fragmentShaderSource);
+    hashString(hash, (const char*) glGetString(GL_VENDOR));
+    hashString(hash, (const char*) glGetString(GL_RENDERER));
+    hashString(hash, (const char*) glGetString(GL_VERSION));
+
+    std::ostringstream path;
+    path << programCacheDirectory << "/" << std::hex << hash << ".glprogram";
+    return path.str();
+}
+
+// File: a header with the binary format and length, followed by the binary
+struct ProgramBinaryHeader {
+    char magic[8];
+    GLenum format;
+    uint32_t length;
+};
+
+static const char PROGRAM_BINARY_MAGIC[8] = { 'G', 'L', 'P', 'R', 'O', 'G', '1', '\0' };
+
+// Return 0 if the file is missing, truncated, or if the driver rejects it (after an update of
+// the driver for instance)
+static GLuint loadProgramBinary(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file) {
+        return 0;
+    }
+
+    ProgramBinaryHeader header;
+    std::vector<char> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC)) == 0 &&
+                 header.length > 0;
+    if(valid) {
+        // A truncated or overlong binary is not handed to the driver
+        binary.resize(header.length);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size() && fgetc(file) == EOF;
+    }
+    fclose(file);
+    if(!valid) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), binary.size());
+
+    GLint linkStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    if(linkStatus == GL_FALSE) {
+        glGetError(); // Unknown formats raise GL_INVALID_ENUM
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static void saveProgramBinary(GLuint program, const std::string& path) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0) {
+        return;
+    }
+
+    ProgramBinaryHeader header;
+    memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC));
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, &length, &header.format, binary.data());
+    header.length = length;
+
+    // Write next to the destination then rename, so that a reader never sees a partial file
+    mkdir(programCacheDirectory.c_str(), 0755);
+    std::string tmpPath = path + ".tmp" + std::to_string(getpid());
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if(!file) {
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(binary.data(), 1, length, file) == size_t(length);
+    if(fclose(file) != 0 || !written || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+    }
+}
+
 GLuint buildProgram(const GLchar* vertexShaderSource, const GLchar* fragmentShaderSource) {
+    // Binary of a previous launch
+    bool useCache = programCacheEnabled && GLEW_ARB_get_program_binary;
+    std::string cachePath;
+    if(useCache) {
+        cachePath = programCachePath(vertexShaderSource, fragmentShaderSource);
+        if(GLuint program = loadProgramBinary(cachePath)) {
+            return program;
+        }
+    }
+
     // Vertex Shader Creation
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 
@@ -71,6 +194,9 @@ GLuint buildProgram(const GLchar* vertexShaderSource, const GLchar* fragmentShad
     glDeleteShader(fragmentShader);
 
     // Link
+    if(useCache) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(program);
 
     GLint linkStatus;
@@ -89,6 +215,10 @@ GLuint buildProgram(const GLchar* vertexShaderSource, const GLchar* fragmentShad
         return 0;
     }
 
+    if(useCache) {
+        saveProgramBinary(program, cachePath);
+    }
+
     return program;
 }
 
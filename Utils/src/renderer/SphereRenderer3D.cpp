@@ -0,0 +1,166 @@
+#include "Utils/renderer/SphereRenderer3D.hpp"
+#include "Utils/renderer/GLState.hpp"
+#include "Utils/renderer/GLtools.hpp"
+
+#include <cstddef>
+#include <map>
+
+namespace Utils {
+
+// The unit sphere is both the position and the normal. It is drawn where the flag collides
+// with it, SPHERE_COLLISION_MARGIN beyond its radius.
+const GLchar* SphereRenderer3D::VERTEX_SHADER =
+"#version 330 core\n"
+GL_STRINGIFY(
+    layout(location = 0) in vec3 aVertexPosition;
+    layout(location = 1) in vec3 aSphereCenter;
+    layout(location = 2) in float aSphereRadius;
+
+    uniform mat4 uMVPMatrix;
+    uniform mat4 uMVMatrix;
+    uniform float uCollisionMargin;
+
+    out vec3 vFragPosition;
+    out vec3 vFragNormal;
+
+    void main() {
+        vec4 position = vec4(aSphereCenter + (aSphereRadius + uCollisionMargin) * aVertexPosition, 1);
+        vFragPosition = vec3(uMVPMatrix * position);
+        vFragNormal = vec3(uMVMatrix * vec4(aVertexPosition, 0));
+        gl_Position = uMVPMatrix * position;
+    }
+);
+
+const GLchar* SphereRenderer3D::FRAGMENT_SHADER =
+"#version 330 core\n"
+GL_STRINGIFY(
+    in vec3 vFragPosition;
+    in vec3 vFragNormal;
+
+    out vec3 fFragColor;
+
+    void main() {
+        fFragColor = vec3(0.9, 0.45, 0.3) * abs(dot(normalize(vFragPosition), normalize(vFragNormal)));
+    }
+);
+
+SphereRenderer3D::SphereRenderer3D(uint subdivisionCount):
+    m_ProgramID(buildProgram(VERTEX_SHADER, FRAGMENT_SHADER)),
+    m_ProjMatrix(1.f), m_ViewMatrix(1.f), m_bMatricesDirty(true),
+    m_nIndexCount(0), m_nInstanceCapacity(0) {
+
+    // Icosahedron
+    const float t = (1.f + glm::sqrt(5.f)) / 2.f;
+    std::vector<glm::vec3> vertexBuffer = {
+        glm::vec3(-1, t, 0), glm::vec3(1, t, 0), glm::vec3(-1, -t, 0), glm::vec3(1, -t, 0),
+        glm::vec3(0, -1, t), glm::vec3(0, 1, t), glm::vec3(0, -1, -t), glm::vec3(0, 1, -t),
+        glm::vec3(t, 0, -1), glm::vec3(t, 0, 1), glm::vec3(-t, 0, -1), glm::vec3(-t, 0, 1)
+    };
+    std::vector<GLushort> indexBuffer = {
+        0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+        1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+        3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+        4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1
+    };
+    for(auto& vertex : vertexBuffer) {
+        vertex = glm::normalize(vertex);
+    }
+
+    // Each triangle is split in four, the midpoints of the edges being shared
+    for(uint s = 0; s < subdivisionCount; ++s) {
+        std::map<std::pair<GLushort, GLushort>, GLushort> midpoints;
+        auto midpoint = [&](GLushort a, GLushort b) {
+            auto edge = std::make_pair(glm::min(a, b), glm::max(a, b));
+            auto it = midpoints.find(edge);
+            if(it != midpoints.end()) {
+                return it->second;
+            }
+            vertexBuffer.push_back(glm::normalize(vertexBuffer[a] + vertexBuffer[b]));
+            return midpoints[edge] = GLushort(vertexBuffer.size() - 1);
+        };
+
+        std::vector<GLushort> subdivided;
+        subdivided.reserve(4 * indexBuffer.size());
+        for(size_t k = 0; k < indexBuffer.size(); k += 3) {
+            GLushort a = indexBuffer[k], b = indexBuffer[k + 1], c = indexBuffer[k + 2];
+            GLushort ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            subdivided.insert(subdivided.end(), {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+        }
+        indexBuffer.swap(subdivided);
+    }
+    m_nIndexCount = indexBuffer.size();
+
+    // VAO
+    glGenVertexArrays(1, &m_VAOID);
+    GLState::current().bindVertexArray(m_VAOID);
+
+    glGenBuffers(1, &m_VBOID);
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBOID);
+    glBufferData(GL_ARRAY_BUFFER, vertexBuffer.size() * sizeof(glm::vec3), vertexBuffer.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+
+    glGenBuffers(1, &m_IBOID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_IBOID);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.size() * sizeof(GLushort), indexBuffer.data(), GL_STATIC_DRAW);
+
+    // One instance per Sphere, read in place
+    glGenBuffers(1, &m_InstanceBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, m_InstanceBufferID);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Sphere), (const GLvoid*) offsetof(Sphere, center));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Sphere), (const GLvoid*) offsetof(Sphere, radius));
+    glVertexAttribDivisor(2, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GLState::current().bindVertexArray(0);
+
+    m_uMVPMatrix = glGetUniformLocation(m_ProgramID, "uMVPMatrix");
+    m_uMVMatrix = glGetUniformLocation(m_ProgramID, "uMVMatrix");
+
+    GLState::current().useProgram(m_ProgramID);
+    glUniform1f(glGetUniformLocation(m_ProgramID, "uCollisionMargin"), SPHERE_COLLISION_MARGIN);
+}
+
+SphereRenderer3D::~SphereRenderer3D() {
+    glDeleteBuffers(1, &m_VBOID);
+    glDeleteBuffers(1, &m_IBOID);
+    glDeleteBuffers(1, &m_InstanceBufferID);
+    GLState::current().deleteVertexArray(m_VAOID);
+    GLState::current().deleteProgram(m_ProgramID);
+}
+
+void SphereRenderer3D::drawSpheres(const std::vector<Sphere>& spheres, bool wireframe) {
+    if(spheres.empty()) {
+        return;
+    }
+
+    // Orphaned each frame, reallocated only when there are more spheres than ever
+    glBindBuffer(GL_ARRAY_BUFFER, m_InstanceBufferID);
+    m_nInstanceCapacity = glm::max(m_nInstanceCapacity, spheres.size());
+    glBufferData(GL_ARRAY_BUFFER, m_nInstanceCapacity * sizeof(Sphere), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, spheres.size() * sizeof(Sphere), spheres.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLState& state = GLState::current();
+    state.enable(GLState::DEPTH_TEST);
+    state.disable(GLState::PRIMITIVE_RESTART);
+
+    state.useProgram(m_ProgramID);
+
+    if(m_bMatricesDirty) {
+        glUniformMatrix4fv(m_uMVPMatrix, 1, GL_FALSE, glm::value_ptr(m_ProjMatrix * m_ViewMatrix));
+        glUniformMatrix4fv(m_uMVMatrix, 1, GL_FALSE, glm::value_ptr(m_ViewMatrix));
+        m_bMatricesDirty = false;
+    }
+
+    state.polygonMode(wireframe ? GL_LINE : GL_FILL);
+
+    state.bindVertexArray(m_VAOID);
+    glDrawElementsInstanced(GL_TRIANGLES, m_nIndexCount, GL_UNSIGNED_SHORT, 0, spheres.size());
+    state.bindVertexArray(0);
+}
+
+}
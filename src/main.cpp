@@ -1,10 +1,29 @@
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
 
 #include <Utils/glm.hpp>
 #include <Utils/WindowManager.hpp>
+#include <Utils/HeadlessContext.hpp>
+#include <Utils/ImageSequenceWriter.hpp>
 #include <Utils/renderer/FlagRenderer3D.hpp>
+#include <Utils/renderer/FlagBatchRenderer3D.hpp>
+#include <Utils/renderer/SphereRenderer3D.hpp>
+#include <Utils/renderer/FrameReader.hpp>
+#include <Utils/renderer/FrameProfiler.hpp>
+#include <Utils/renderer/GLState.hpp>
+#include <Utils/renderer/GLtools.hpp>
 #include <Utils/renderer/TrackballCamera.hpp>
 #include <Utils/Flag.h>
+#include <Utils/FlagRecording.hpp>
+#include <Utils/FlagSnapshot.hpp>
+#include <Utils/TimestepController.hpp>
+#include <Utils/WindField.hpp>
 
 #include <AntTweakBar/AntTweakBar.h>
 #include <AntTweakBar/atb.hpp>
@@ -13,34 +32,266 @@
 static const Uint32 WINDOW_WIDTH = 1024;
 static const Uint32 WINDOW_HEIGHT = 768;
 
+// Warm-up run from the rest pose before the first frame, cached by parameter hash
+static const float SETTLE_DT = 0.16f;
+static const uint32_t SETTLE_STEP_COUNT = 300;
+
+// Simulated time per frame without a window, as in a window at 60 fps
+static const float HEADLESS_DT = 0.01f * 1000.f / 60.f;
+
+// Distance between the copies of the flag drawn with --batch
+static const float BATCH_SPACING = 6.f;
+
+// Air velocity for a unit of wind in the GUI, when the wind acts through aerodynamics
+static const float AIR_SPEED_SCALE = 50.f;
+
+// Bounds of the adaptive simulation timestep
+static const float MIN_DT = 0.005f;
+static const float MAX_DT = 0.5f;
+
+// Parts of a frame timed on the CPU and the GPU
+enum FramePass {
+    PASS_FLAG,
+    PASS_SPHERES,
+    PASS_BATCH,
+    PASS_SIMULATION,
+    PASS_GUI,
+    PASS_SWAP
+};
+static const char* const FRAME_PASS_NAMES[] = { "Flag", "Spheres", "Batch", "Simulation", "GUI", "Swap" };
+
 using namespace Utils;
 
 
-int main() {
-    WindowManager wm(WINDOW_WIDTH, WINDOW_HEIGHT, "Flag Simulation");
-    wm.setFramerate(60);
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--record <file>] [--play <file>]"
+              << " [--load <snapshot>] [--save <snapshot>] [--cache <dir>] [--no-cache]"
+              << " [--compare-precision <steps>] [--grid <width>x<height>] [--tiled]"
+              << " [--blocked <substeps>] [--hem] [--tear <strain>]"
+              << " [--turbulence <strength>] [--aero] [--vertex-format full|packed|compact|positions]"
+              << " [--batch <copies>] [--headless <file.y4m|frame%04d.png> [--frames <count>]]" << std::endl;
+}
+
+// Advance the simulation by one step
+template<typename FlagType>
+static void simulate(FlagType& flag, const std::vector<Sphere>& spheres, const glm::vec3& G, const glm::vec3& W, float dt) {
+    flag.applyExternalForce(G); // Gravity
+    flag.applyExternalForce(W); // Wind
+    flag.applyInternalForces(dt); // Internal forces
+
+    for(auto &sphere : spheres){
+      flag.sphereCollision(sphere, dt);
+    }
+
+    flag.update(dt); // Update system
+}
+
+// Maximum distance between the positions of a flag and the double precision reference
+template<typename FlagType>
+static double positionError(const FlagType& flag, const FlagDouble& reference) {
+    double error = 0.;
+    for (size_t k = 0; k < reference.positionArray.size(); ++k) {
+        error = glm::max(error, glm::distance(glm::dvec3(flag.positionArray[k]), reference.positionArray[k]));
+    }
+    return error;
+}
+
+// Run the default scene in float, fp16 storage and double precision side by side
+static void comparePrecision(uint32_t stepCount) {
+    Flag flag(4096.f, 4, 3, 32, 16);
+    FlagHalf flagHalf(4096.f, 4, 3, 32, 16);
+    FlagDouble reference(4096., 4, 3, 32, 16);
+    glm::vec3 G(0.f, -0.002f, 0.f);
+    glm::vec3 W(0.02f, 0.f, -0.002f);
+
+    std::vector<Sphere> spheres;
+    spheres.push_back(Sphere(glm::vec3(-1.f,0,-0.1), 1.f));
+    spheres.push_back(Sphere(glm::vec3(1.5,0,0.1), 0.5f));
+
+    for (uint32_t i = 1; i <= stepCount; ++i) {
+        simulate(flag, spheres, G, W, SETTLE_DT);
+        simulate(flagHalf, spheres, G, W, SETTLE_DT);
+        simulate(reference, spheres, G, W, SETTLE_DT);
+
+        if (i % 100 == 0 || i == stepCount) {
+            std::cout << "step " << i << ": float error " << positionError(flag, reference)
+                      << ", fp16 storage error " << positionError(flagHalf, reference) << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* recordPath = nullptr; // Write every simulated frame to this file
+    const char* playPath = nullptr; // Replay a recording instead of simulating
+    const char* loadPath = nullptr; // Start from this snapshot
+    const char* savePath = nullptr; // Snapshot of the state on exit
+    const char* cacheDirectory = ".flag_cache"; // Settled states, or null to always settle
+    uint gridWidth = 32, gridHeight = 16;
+    FlagLayout layout = ROW_MAJOR;
+    uint blockedSubstepCount = 0; // Substeps per frame advanced block by block, 0 for the adaptive timestep
+    bool hem = false; // Stiffer material on the free edge
+    float tearStrain = 0.f; // Springs break past this relative stretch, 0 for an untearable flag
+    float turbulence = 0.f; // Strength of the wind field added to the uniform wind
+    bool aerodynamics = false; // Wind pushes the triangles according to their orientation
+    VertexFormat vertexFormat = VERTEX_FULL;
+    uint batchFlagCount = 0; // Copies of the flag drawn behind it in a single call
+    const char* headlessPath = nullptr; // Render offscreen to this video or image sequence
+    uint headlessFrameCount = 300;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (!strcmp(argv[i], "--play") && i + 1 < argc) {
+            playPath = argv[++i];
+        } else if (!strcmp(argv[i], "--load") && i + 1 < argc) {
+            loadPath = argv[++i];
+        } else if (!strcmp(argv[i], "--save") && i + 1 < argc) {
+            savePath = argv[++i];
+        } else if (!strcmp(argv[i], "--cache") && i + 1 < argc) {
+            cacheDirectory = argv[++i];
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            cacheDirectory = nullptr;
+        } else if (!strcmp(argv[i], "--grid") && i + 1 < argc &&
+                   sscanf(argv[++i], "%ux%u", &gridWidth, &gridHeight) == 2 && gridWidth > 1 && gridHeight > 1) {
+        } else if (!strcmp(argv[i], "--blocked") && i + 1 < argc && (blockedSubstepCount = atoi(argv[++i])) > 0) {
+        } else if (!strcmp(argv[i], "--tiled")) {
+            layout = TILED;
+        } else if (!strcmp(argv[i], "--hem")) {
+            hem = true;
+        } else if (!strcmp(argv[i], "--tear") && i + 1 < argc && (tearStrain = atof(argv[++i])) > 0.f) {
+        } else if (!strcmp(argv[i], "--aero")) {
+            aerodynamics = true;
+        } else if (!strcmp(argv[i], "--vertex-format") && i + 1 < argc) {
+            ++i;
+            if (!strcmp(argv[i], "packed")) {
+                vertexFormat = VERTEX_PACKED_NORMAL;
+            } else if (!strcmp(argv[i], "compact")) {
+                vertexFormat = VERTEX_COMPACT;
+            } else if (!strcmp(argv[i], "positions")) {
+                vertexFormat = VERTEX_POSITION_ONLY;
+            } else if (strcmp(argv[i], "full")) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--headless") && i + 1 < argc) {
+            headlessPath = argv[++i];
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc && (headlessFrameCount = atoi(argv[++i])) > 0) {
+        } else if (!strcmp(argv[i], "--batch") && i + 1 < argc && (batchFlagCount = atoi(argv[++i])) > 0) {
+        } else if (!strcmp(argv[i], "--turbulence") && i + 1 < argc && (turbulence = atof(argv[++i])) >= 0.f) {
+        } else if (!strcmp(argv[i], "--compare-precision") && i + 1 < argc) {
+            comparePrecision(atoi(argv[++i]));
+            return EXIT_SUCCESS;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Blocked steps apply a uniform force with a fixed substep count
+    if (blockedSubstepCount && (turbulence > 0.f || aerodynamics)) {
+        std::cerr << "--blocked cannot be combined with --turbulence or --aero" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::unique_ptr<FlagPlayback> playback;
+    if (playPath) {
+        try {
+            playback.reset(new FlagPlayback(playPath));
+        } catch (const std::runtime_error& error) {
+            std::cerr << error.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // A window, or an offscreen framebuffer of the same size
+    std::unique_ptr<WindowManager> wm;
+    std::unique_ptr<HeadlessContext> headless;
+    if (headlessPath) {
+        headless.reset(new HeadlessContext(WINDOW_WIDTH, WINDOW_HEIGHT));
+    } else {
+        wm.reset(new WindowManager(WINDOW_WIDTH, WINDOW_HEIGHT, "Flag Simulation"));
+        wm->setFramerate(60);
+    }
+
+    // Shaders compiled by a previous launch, kept next to the settled states
+    setProgramCacheDirectory(cacheDirectory);
 
     TwInit(TW_OPENGL_CORE, NULL);
     TwWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    Flag flag(4096.f, 4, 3, 32, 16); // Flag creation
+    // Flag creation, with the recorded grid size when playing back
+    if (playback) {
+        gridWidth = playback->getGridWidth();
+        gridHeight = playback->getGridHeight();
+    }
+    Flag flag(4096.f, 4, 3, gridWidth, gridHeight, layout);
+    if (hem) {
+        // Folded fabric on the two last columns : harder to bend and to shear
+        uint hemMaterial = flag.addMaterial(flag.K0, 4.f * flag.K1, 4.f * flag.K2, flag.V0, 4.f * flag.V1, flag.V2);
+        flag.setMaterial(gridWidth - 2, 0, gridWidth, gridHeight, hemMaterial);
+    }
+    flag.tearStrain = tearStrain;
+    flag.dragCoefficient = 1.f;
+    flag.liftCoefficient = 0.5f;
     glm::vec3 G(0.f, -0.002f, 0.f); // Gravity
     glm::vec3 W(0.02f, 0.f, -0.002f); // Wind
 
-    FlagRenderer3D renderer(flag.gridWidth, flag.gridHeight);
-    renderer.setProjMatrix(glm::perspective(70.f, float(WINDOW_WIDTH) / WINDOW_HEIGHT, 0.1f, 100.f));
-
-    TrackballCamera camera;
-    int mouseLastX, mouseLastY;
-
     // Init spheres
     std::vector<Sphere> spheres;
     spheres.push_back(Sphere(glm::vec3(-1.f,0,-0.1), 1.f));
     spheres.push_back(Sphere(glm::vec3(1.5,0,0.1), 0.5f));
 
+    // Initial state: an explicit snapshot, or the settled rest pose
+    if (playback) {
+        // Nothing is simulated
+    } else if (loadPath) {
+        if (!loadSnapshot(loadPath, flag, spheres) || spheres.size() != 2) {
+            std::cerr << "Unable to load snapshot " << loadPath << std::endl;
+            return EXIT_FAILURE;
+        }
+    } else {
+        uint64_t key = snapshotKey(flag, spheres, G, W, SETTLE_DT, SETTLE_STEP_COUNT);
+        SnapshotCache cache(cacheDirectory ? cacheDirectory : "");
+
+        if (!cacheDirectory || !cache.load(key, flag, spheres)) {
+            for (uint32_t i = 0; i < SETTLE_STEP_COUNT; ++i) {
+                simulate(flag, spheres, G, W, SETTLE_DT);
+            }
+            if (cacheDirectory) {
+                cache.save(key, flag, spheres);
+            }
+        }
+    }
+
+    FlagRenderer3D renderer(flag.gridWidth, flag.gridHeight, vertexFormat);
+    renderer.setProjMatrix(glm::perspective(70.f, float(WINDOW_WIDTH) / WINDOW_HEIGHT, 0.1f, 100.f));
+
+    SphereRenderer3D sphereRenderer;
+    sphereRenderer.setProjMatrix(glm::perspective(70.f, float(WINDOW_WIDTH) / WINDOW_HEIGHT, 0.1f, 100.f));
+    bool showSpheres = true;
+
+    // Copies of the flag in rows behind it
+    std::unique_ptr<FlagBatchRenderer3D> batchRenderer;
+    std::vector<const glm::vec3*> batchPositionArrays(batchFlagCount);
+    std::vector<glm::mat4> batchModelMatrices(batchFlagCount);
+    if (batchFlagCount) {
+        batchRenderer.reset(new FlagBatchRenderer3D(flag.gridWidth, flag.gridHeight, batchFlagCount));
+        batchRenderer->setProjMatrix(glm::perspective(70.f, float(WINDOW_WIDTH) / WINDOW_HEIGHT, 0.1f, 100.f));
+
+        uint rowLength = uint(glm::ceil(glm::sqrt(float(batchFlagCount))));
+        for (uint k = 0; k < batchFlagCount; ++k) {
+            glm::vec3 offset(float(k % rowLength) - 0.5f * (rowLength - 1), 0.f, -float(k / rowLength + 1));
+            batchModelMatrices[k] = glm::translate(glm::mat4(1.f), BATCH_SPACING * offset);
+        }
+    }
+
+    TrackballCamera camera;
+    int mouseLastX, mouseLastY;
+
     // Init GUI
     TwBar* gui = TwNewBar("Spheres and Wind parameters");
 
+    TwAddVarRW(gui, "ShowSpheres", TW_TYPE_BOOLCPP, &showSpheres, " label='Show spheres' ");
     TwAddVarRW(gui, "X", TW_TYPE_FLOAT, &spheres[0].center.x, " min=-5 max=5 step=0.1 group=Sphere1 label='X' ");
     TwAddVarRW(gui, "Y", TW_TYPE_FLOAT, &spheres[0].center.y, " min=-5 max=5 step=0.1 group=Sphere1 label='Y' ");
     TwAddVarRW(gui, "Z", TW_TYPE_FLOAT, &spheres[0].center.z, " min=-5 max=5 step=0.1 group=Sphere1 label='Z' ");
@@ -54,40 +305,243 @@ int main() {
     TwAddVarRW(gui, "X2", TW_TYPE_FLOAT, &W.x, " min=-0.05 max=0.05 step=0.01 group=Wind label='X' ");
     TwAddVarRW(gui, "Y2", TW_TYPE_FLOAT, &W.y, " min=-0.05 max=0.05 step=0.01 group=Wind label='Y' ");
     TwAddVarRW(gui, "Z2", TW_TYPE_FLOAT, &W.z, " min=-0.05 max=0.05 step=0.01 group=Wind label='Z' ");
+    if (!blockedSubstepCount) {
+        TwAddVarRW(gui, "Turbulence", TW_TYPE_FLOAT, &turbulence, " min=0 max=0.05 step=0.005 group=Wind label='Turbulence' ");
+        TwAddVarRW(gui, "Aerodynamics", TW_TYPE_BOOLCPP, &aerodynamics, " group=Wind label='Aerodynamics' ");
+        TwAddVarRW(gui, "Drag", TW_TYPE_FLOAT, &flag.dragCoefficient, " min=0 max=5 step=0.1 group=Wind label='Drag' ");
+        TwAddVarRW(gui, "Lift", TW_TYPE_FLOAT, &flag.liftCoefficient, " min=0 max=5 step=0.1 group=Wind label='Lift' ");
+    }
+
+    TwAddVarRW(gui, "TearStrain", TW_TYPE_FLOAT, &flag.tearStrain, " min=0 max=2 step=0.05 label='Tear strain' ");
+
+    std::unique_ptr<FlagRecorder> recorder;
+    if (recordPath) {
+        try {
+            recorder.reset(new FlagRecorder(recordPath, flag.gridWidth, flag.gridHeight));
+        } catch (const std::runtime_error& error) {
+            std::cerr << error.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Playback state: frames are drawn straight from the mapped recording
+    uint32_t frame = 0, lastFrame = 0;
+    float playbackTime = 0.f;
+    bool playing = true;
+
+    if (playback) {
+        TwBar* playbackGui = TwNewBar("Playback");
+        std::string frameDef = " min=0 max=" + std::to_string(playback->getFrameCount() - 1) + " label='Frame' ";
+        TwAddVarRW(playbackGui, "Frame", TW_TYPE_UINT32, &frame, frameDef.c_str());
+        TwAddVarRW(playbackGui, "Playing", TW_TYPE_BOOLCPP, &playing, " label='Playing' key=p ");
+    }
+
+    // Simulated time, stored with each recorded frame
+    float time = 0.f;
+
+    TimestepController timestep(MIN_DT, MAX_DT);
+    bool adaptiveTimestep = true;
+
+    if (!playback) {
+        TwBar* timestepGui = TwNewBar("Timestep");
+        // The controller is not used by blocked steps
+        if (!blockedSubstepCount) {
+            TwAddVarRW(timestepGui, "Adaptive", TW_TYPE_BOOLCPP, &adaptiveTimestep, " label='Adaptive' ");
+            TwAddVarCB(timestepGui, "Dt", TW_TYPE_FLOAT, nullptr,
+                       [](void* value, void* controller) { *static_cast<float*>(value) = static_cast<TimestepController*>(controller)->getTimestep(); },
+                       &timestep, " label='Substep dt' ");
+            TwAddVarCB(timestepGui, "Substeps", TW_TYPE_UINT32, nullptr,
+                       [](void* value, void* controller) { *static_cast<uint32_t*>(value) = static_cast<TimestepController*>(controller)->getSubstepCount(); },
+                       &timestep, " label='Substeps' ");
+            TwAddVarCB(timestepGui, "Rollbacks", TW_TYPE_UINT32, nullptr,
+                       [](void* value, void* controller) { *static_cast<uint32_t*>(value) = static_cast<TimestepController*>(controller)->getRollbackCount(); },
+                       &timestep, " label='Rollbacks' ");
+        }
 
+        // Tiles at rest are skipped until something moves near them
+        flag.sleepThreshold = 1e-6f;
+        TwAddVarRW(timestepGui, "SleepThreshold", TW_TYPE_FLOAT, &flag.sleepThreshold, " min=0 max=0.001 step=0.000001 label='Sleep threshold' ");
+        TwAddVarRO(timestepGui, "SleepingTiles", TW_TYPE_UINT32, &flag.sleepingTileCount, " label='Sleeping tiles' ");
+    }
+
+
+    // Time of each pass, to tell whether the frame is bound by the CPU or by the GPU
+    FrameProfiler profiler(std::vector<std::string>(std::begin(FRAME_PASS_NAMES), std::end(FRAME_PASS_NAMES)));
+    TwBar* timingGui = TwNewBar("Timings");
+    TwDefine(" Timings iconified=true ");
+    for (uint pass = 0; pass < profiler.getPassCount(); ++pass) {
+        std::string group = " group=" + profiler.getPassName(pass);
+        TwAddVarRO(timingGui, ("CPU" + profiler.getPassName(pass)).c_str(), TW_TYPE_FLOAT, &profiler.getCPUTime(pass), (group + " label='CPU ms' precision=3 ").c_str());
+        if (profiler.hasGPUTimes()) {
+            TwAddVarRO(timingGui, ("GPU" + profiler.getPassName(pass)).c_str(), TW_TYPE_FLOAT, &profiler.getGPUTime(pass), (group + " label='GPU ms' precision=3 ").c_str());
+        }
+    }
+    TwAddVarRO(timingGui, "CPUTotal", TW_TYPE_FLOAT, &profiler.getCPUTotal(), " group=Frame label='CPU ms' precision=3 ");
+    if (profiler.hasGPUTimes()) {
+        TwAddVarRO(timingGui, "GPUTotal", TW_TYPE_FLOAT, &profiler.getGPUTotal(), " group=Frame label='GPU ms' precision=3 ");
+    }
+
+    // Gusts around the flag
+    WindField windField(glm::vec3(-4.f), glm::vec3(4.f));
+    std::vector<glm::vec3> windArray(flag.positionArray.size());
+
+    auto step = [&](float substepDt) {
+        if (turbulence > 0.f) {
+            windField.sample(flag.positionArray.data(), windArray.data(), windArray.size());
+        }
+
+        if (aerodynamics) {
+            // The wind is an air velocity, and the field too (see its strength below)
+            flag.applyAerodynamicForces(AIR_SPEED_SCALE * W, turbulence > 0.f ? windArray.data() : nullptr);
+            simulate(flag, spheres, G, glm::vec3(0.f), substepDt);
+        } else {
+            if (turbulence > 0.f) {
+                flag.applyExternalForces(windArray.data());
+            }
+            simulate(flag, spheres, G, W, substepDt);
+        }
+    };
+
+    // Frames read back asynchronously and encoded on a worker thread
+    std::unique_ptr<ImageSequenceWriter> frameWriter;
+    std::unique_ptr<FrameReader> frameReader;
+    uint headlessFrame = 0;
+    if (headless) {
+        frameWriter.reset(new ImageSequenceWriter(headlessPath, WINDOW_WIDTH, WINDOW_HEIGHT, 60));
+        frameReader.reset(new FrameReader(*frameWriter));
+    }
 
     // Time between each frame
     float dt = 0.f;
 
+    // The normals of the flag match its positions, and can be drawn as they are
+    bool flagNormalsCurrent = false;
+
     bool done = false;
     bool wireframe = false;
     while (!done) {
-        wm.startMainLoop();
+        if (wm) {
+            wm->startMainLoop();
+        }
 
         // Render
+        profiler.begin(PASS_FLAG);
         renderer.clear();
 
         renderer.setViewMatrix(camera.getViewMatrix());
-        renderer.drawGrid(flag.positionArray.data(), wireframe);
+        // Coarser grid when the quads get smaller than a few pixels
+        renderer.setLevelOfDetail(renderer.selectLevelOfDetail(flag.L0.x, camera.getDistance(), WINDOW_HEIGHT));
+
+        const glm::vec3* positions;
+        if (playback) {
+            frame = glm::min(frame, playback->getFrameCount() - 1);
+            positions = playback->getFrame(frame);
+            renderer.drawGrid(positions, wireframe);
+        } else {
+            // Triangles torn since the previous frame
+            if (!flag.tornTriangleArray.empty()) {
+                renderer.removeTriangles(flag.tornTriangleArray.data(), flag.tornTriangleArray.size());
+                flag.tornTriangleArray.clear();
+            }
+            // Normals of the flag after its last step, or computed by the renderer
+            positions = flag.rowMajorPositions();
+            if (flagNormalsCurrent) {
+                renderer.drawGrid(positions, flag.normals, wireframe);
+            } else {
+                renderer.drawGrid(positions, wireframe);
+            }
+        }
+        profiler.end(PASS_FLAG);
+
+        // The recordings do not store the spheres
+        if (showSpheres && !playback) {
+            profiler.begin(PASS_SPHERES);
+            sphereRenderer.setViewMatrix(camera.getViewMatrix());
+            sphereRenderer.drawSpheres(spheres, wireframe);
+            profiler.end(PASS_SPHERES);
+        }
+
+        if (batchRenderer) {
+            profiler.begin(PASS_BATCH);
+            std::fill(batchPositionArrays.begin(), batchPositionArrays.end(), positions);
+            batchRenderer->setViewMatrix(camera.getViewMatrix());
+            batchRenderer->drawFlags(batchPositionArrays.data(), batchModelMatrices.data(), batchFlagCount, wireframe);
+            profiler.end(PASS_BATCH);
+        }
+
+        profiler.begin(PASS_SIMULATION);
+
+        // Playback
+        if (playback) {
+            // The frame was scrubbed from the GUI or the keyboard
+            if (frame != lastFrame) {
+                playbackTime = playback->getFrameTime(frame);
+            }
+
+            if (playing && dt > 0.f) {
+                playbackTime += dt;
+                if (playbackTime > playback->getFrameTime(playback->getFrameCount() - 1)) {
+                    playbackTime = playback->getFrameTime(0);
+                }
+                frame = playback->findFrame(playbackTime);
+            }
+            lastFrame = frame;
+
+            if (frame + 1 < playback->getFrameCount()) {
+                playback->prefetch(frame + 1);
+            }
+        }
 
         // Simulation
-        if (dt > 0.f) {
-            flag.applyExternalForce(G); // Gravity
-            flag.applyExternalForce(W); // Wind
-            flag.applyInternalForces(dt); // Internal forces
+        else if (dt > 0.f) {
+            if (turbulence > 0.f) {
+                windField.setStrength(aerodynamics ? AIR_SPEED_SCALE * turbulence : turbulence);
+                windField.setTime(time);
+            }
+
+            // The adaptive timestep may fall behind when too many substeps are needed
+            float simulatedDt = dt;
+            if (blockedSubstepCount) {
+                flag.stepBlocked(dt / blockedSubstepCount, blockedSubstepCount, G + W, spheres);
+            } else if (adaptiveTimestep) {
+                simulatedDt = timestep.advance(flag, dt, step);
+            } else {
+                step(dt);
+            }
 
-            for(auto &sphere : spheres){
-              flag.sphereCollision(sphere, dt);
+            time += simulatedDt;
+
+            // The aerodynamic steps compute the normals before moving the flag: compute them
+            // again for the final positions, the renderer then skips its own computation
+            flagNormalsCurrent = aerodynamics;
+            if (flagNormalsCurrent) {
+                flag.computeNormals();
+            }
+            if (recorder) {
+                recorder->addFrame(flag.rowMajorPositions(), time);
             }
+        }
+
+        profiler.end(PASS_SIMULATION);
 
-            flag.update(dt); // Update system
+        // Offscreen: no GUI nor events, a fixed time per frame
+        if (frameReader) {
+            frameReader->readFrame();
+            profiler.endFrame();
+            dt = HEADLESS_DT;
+            done = ++headlessFrame == headlessFrameCount;
+            continue;
         }
 
+        profiler.begin(PASS_GUI);
         TwDraw();
+        // The GUI sets its own state and restores it with raw GL calls
+        Utils::GLState::current().invalidate();
+        profiler.end(PASS_GUI);
 
         // Events
         SDL_Event e;
-        while (wm.pollEvent(e)) {
+        while (wm->pollEvent(e)) {
             int handled = TwEventSDL(&e, SDL_MAJOR_VERSION, SDL_MINOR_VERSION);
 
             if(!handled) {
@@ -100,6 +554,10 @@ int main() {
                     case SDL_KEYDOWN:
                         if (e.key.keysym.sym == SDLK_SPACE) {
                             wireframe = !wireframe;
+                        } else if (playback && e.key.keysym.sym == SDLK_LEFT) {
+                            frame = frame > 0 ? frame - 1 : 0;
+                        } else if (playback && e.key.keysym.sym == SDLK_RIGHT) {
+                            frame = glm::min(frame + 1, playback->getFrameCount() - 1);
                         }
                     case SDL_MOUSEBUTTONDOWN:
                         if (e.button.button == SDL_BUTTON_WHEELUP) {
@@ -124,7 +582,17 @@ int main() {
         }
 
         // Window update
-        dt = wm.update();
+        profiler.begin(PASS_SWAP);
+        wm->swapBuffers();
+        profiler.end(PASS_SWAP);
+        dt = wm->waitFrame();
+        profiler.endFrame();
+    }
+
+    profiler.printSummary(std::cout);
+
+    if (savePath && !playback) {
+        saveSnapshot(savePath, flag, spheres);
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// Checks of the test executables: a failed check is reported with its line, and the test
+// carries on so that every failure shows up, then exits with EXIT_FAILURE.
+
+static int checkFailureCount = 0;
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++checkFailureCount; \
+        } \
+    } while(false)
+
+// Exit code of the test
+inline int checkResult() {
+    return checkFailureCount ? EXIT_FAILURE : EXIT_SUCCESS;
+}
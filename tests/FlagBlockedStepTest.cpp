@@ -0,0 +1,114 @@
+#include "Check.hpp"
+
+#include <Utils/Flag.h>
+
+#include <cstring>
+
+static const float DT = 0.01f;
+static const uint SUBSTEP_COUNT = 4;
+
+// Gravity and wind of the demo, applied as one force like main does
+static const glm::vec3 F = glm::vec3(0.f, -0.002f, 0.f) + glm::vec3(0.02f, 0.f, -0.002f);
+
+// Flag larger than a block in both directions, with the mass per vertex of the demo
+static Flag makeFlag(uint gridWidth, uint gridHeight, FlagLayout layout) {
+    Flag flag(8.f * gridWidth * gridHeight, 4.f, 3.f, gridWidth, gridHeight, layout);
+    CHECK(flag.layout == layout);
+    flag.setMaterial(gridWidth / 2, 0, gridWidth, gridHeight / 3, flag.addMaterial(50.f, 2.f, 1.f, 1.f, 0.01f, 0.1f));
+    return flag;
+}
+
+static std::vector<Sphere> makeSpheres() {
+    return { Sphere(glm::vec3(-1.f, 0.f, -0.1f), 1.f), Sphere(glm::vec3(1.5f, 0.f, 0.1f), 0.5f) };
+}
+
+// The passes stepBlocked() stands for
+static void stepPassByPass(Flag& flag, float dt, uint substepCount, const std::vector<Sphere>& spheres) {
+    for (uint s = 0; s < substepCount; ++s) {
+        flag.applyExternalForce(F);
+        flag.applyInternalForces(dt);
+        for (const Sphere& sphere : spheres) {
+            flag.sphereCollision(sphere, dt);
+        }
+        flag.update(dt);
+    }
+}
+
+static float maxDistance(const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b) {
+    float distance = 0.f;
+    for (size_t k = 0; k < a.size(); ++k) {
+        distance = glm::max(distance, glm::distance(a[k], b[k]));
+    }
+    return distance;
+}
+
+static bool sameBytes(const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b) {
+    return a.size() == b.size() && !memcmp(a.data(), b.data(), a.size() * sizeof(glm::vec3));
+}
+
+// Frames of the demo, stepped block by block and pass by pass
+static void compare(uint gridWidth, uint gridHeight, FlagLayout layout, uint frameCount) {
+    const std::vector<Sphere> spheres = makeSpheres();
+    Flag blocked = makeFlag(gridWidth, gridHeight, layout);
+    Flag reference = blocked;
+    const Flag initial = blocked;
+
+    for (uint frame = 0; frame < frameCount; ++frame) {
+        blocked.stepBlocked(DT / SUBSTEP_COUNT, SUBSTEP_COUNT, F, spheres);
+        stepPassByPass(reference, DT / SUBSTEP_COUNT, SUBSTEP_COUNT, spheres);
+    }
+    // How far the flag moved, for the tolerance
+    const float scale = maxDistance(reference.positionArray, initial.positionArray);
+    CHECK(scale > 0.f);
+
+    if (layout == ROW_MAJOR) {
+        // The patches run the same arithmetic on the same vertices in the same order
+        CHECK(sameBytes(blocked.positionArray, reference.positionArray));
+        CHECK(sameBytes(blocked.velocityArray, reference.velocityArray));
+    } else {
+        // The springs are summed in the order of the layout, which the row-major patches differ from
+        CHECK(maxDistance(blocked.positionArray, reference.positionArray) < 1e-4f * scale);
+        CHECK(maxDistance(blocked.velocityArray, reference.velocityArray) < 1e-3f);
+    }
+}
+
+// The patch kept between calls adapts to flags of other sizes
+static void testPatchReuse() {
+    const std::vector<Sphere> spheres = makeSpheres();
+    Flag small = makeFlag(40, 24, ROW_MAJOR), large = makeFlag(136, 72, ROW_MAJOR);
+    Flag smallReference = small, largeReference = large;
+
+    for (uint frame = 0; frame < 10; ++frame) {
+        large.stepBlocked(DT / SUBSTEP_COUNT, SUBSTEP_COUNT, F, spheres);
+        small.stepBlocked(DT / SUBSTEP_COUNT, SUBSTEP_COUNT, F, spheres);
+        stepPassByPass(largeReference, DT / SUBSTEP_COUNT, SUBSTEP_COUNT, spheres);
+        stepPassByPass(smallReference, DT / SUBSTEP_COUNT, SUBSTEP_COUNT, spheres);
+    }
+    CHECK(sameBytes(small.positionArray, smallReference.positionArray));
+    CHECK(sameBytes(large.positionArray, largeReference.positionArray));
+}
+
+// A flag that can tear is stepped pass by pass
+static void testTearing() {
+    const std::vector<Sphere> spheres = makeSpheres();
+    Flag blocked = makeFlag(136, 72, ROW_MAJOR);
+    blocked.tearStrain = 0.5f;
+    blocked.tearSpring(70, 30, SPRING_DOWN);
+    Flag reference = blocked;
+
+    for (uint frame = 0; frame < 10; ++frame) {
+        blocked.stepBlocked(DT / SUBSTEP_COUNT, SUBSTEP_COUNT, F, spheres);
+        stepPassByPass(reference, DT / SUBSTEP_COUNT, SUBSTEP_COUNT, spheres);
+    }
+    CHECK(sameBytes(blocked.positionArray, reference.positionArray));
+    CHECK(blocked.springMaskArray == reference.springMaskArray);
+}
+
+int main() {
+    compare(136, 72, ROW_MAJOR, 20);
+    compare(136, 72, TILED, 20);
+    compare(64, 64, ROW_MAJOR, 20);
+    testPatchReuse();
+    testTearing();
+    return checkResult();
+}
@@ -0,0 +1,135 @@
+#include "Check.hpp"
+
+#include <Utils/FlagRecording.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+using namespace Utils;
+
+static const char* RECORDING_PATH = "FlagRecordingTest.flagrec";
+static const uint32_t WIDTH = 5, HEIGHT = 3, FRAME_COUNT = 4;
+
+static std::vector<glm::vec3> makeFrame(uint32_t frame) {
+    std::vector<glm::vec3> positions(WIDTH * HEIGHT);
+    for (size_t k = 0; k < positions.size(); ++k) {
+        positions[k] = glm::vec3(float(k), float(frame), 0.5f * k * frame);
+    }
+    return positions;
+}
+
+static bool opens(const char* path) {
+    try {
+        FlagPlayback playback(path);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    return true;
+}
+
+static void testRoundTrip() {
+    {
+        FlagRecorder recorder(RECORDING_PATH, WIDTH, HEIGHT);
+        for (uint32_t frame = 0; frame < FRAME_COUNT; ++frame) {
+            recorder.addFrame(makeFrame(frame).data(), 0.1f * (frame + 1));
+        }
+        CHECK(recorder.close());
+    }
+
+    FlagPlayback playback(RECORDING_PATH);
+    CHECK(playback.getGridWidth() == WIDTH && playback.getGridHeight() == HEIGHT);
+    CHECK(playback.getFrameCount() == FRAME_COUNT);
+    for (uint32_t frame = 0; frame < FRAME_COUNT; ++frame) {
+        CHECK(playback.getFrameTime(frame) == 0.1f * (frame + 1));
+        CHECK(!memcmp(playback.getFrame(frame), makeFrame(frame).data(), WIDTH * HEIGHT * sizeof(glm::vec3)));
+        CHECK(playback.findFrame(0.1f * (frame + 1)) == frame);
+    }
+    CHECK(playback.findFrame(0.f) == 0);
+    CHECK(playback.findFrame(100.f) == FRAME_COUNT - 1);
+}
+
+// Headers and frame offsets pointing outside the file are rejected
+static void testInvalidFiles() {
+    std::vector<char> contents;
+    FILE* file = fopen(RECORDING_PATH, "rb");
+    CHECK(file);
+    for (int c; file && (c = fgetc(file)) != EOF; ) {
+        contents.push_back(char(c));
+    }
+    if (file) {
+        fclose(file);
+    }
+    CHECK(contents.size() > sizeof(FlagRecordingHeader));
+    if (contents.size() <= sizeof(FlagRecordingHeader)) {
+        return;
+    }
+
+    FlagRecordingHeader header;
+    memcpy(&header, contents.data(), sizeof(header));
+    const size_t lastOffset = header.indexOffset + (FRAME_COUNT - 1) * sizeof(FlagRecordingIndexEntry);
+
+    auto rejected = [&](const std::vector<char>& bytes) {
+        FILE* file = fopen(RECORDING_PATH, "wb");
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fclose(file);
+        return !opens(RECORDING_PATH);
+    };
+
+    CHECK(rejected(std::vector<char>(contents.begin(), contents.begin() + contents.size() - 1)));
+    CHECK(rejected(std::vector<char>(contents.begin(), contents.begin() + sizeof(header))));
+
+    std::vector<char> badMagic = contents;
+    badMagic[0] = 'X';
+    CHECK(rejected(badMagic));
+
+    // The last frame ends past the index
+    std::vector<char> badOffset = contents;
+    const uint64_t pastIndex = header.indexOffset - WIDTH * HEIGHT * sizeof(glm::vec3) + sizeof(glm::vec3);
+    memcpy(&badOffset[lastOffset], &pastIndex, sizeof(pastIndex));
+    CHECK(rejected(badOffset));
+
+    // A frame inside the header
+    std::vector<char> headerOffset = contents;
+    const uint64_t zero = 0;
+    memcpy(&headerOffset[lastOffset], &zero, sizeof(zero));
+    CHECK(rejected(headerOffset));
+
+    // An offset wrapping around
+    std::vector<char> hugeOffset = contents;
+    const uint64_t huge = ~uint64_t(0) - 3;
+    memcpy(&hugeOffset[lastOffset], &huge, sizeof(huge));
+    CHECK(rejected(hugeOffset));
+
+    // A grid too large for the frames
+    std::vector<char> badGrid = contents;
+    const uint32_t gridHeight = 0x40000000;
+    memcpy(&badGrid[offsetof(FlagRecordingHeader, gridHeight)], &gridHeight, sizeof(gridHeight));
+    CHECK(rejected(badGrid));
+
+    CHECK(!rejected(contents));
+    remove(RECORDING_PATH);
+    CHECK(!opens(RECORDING_PATH));
+}
+
+// A full disk leaves the placeholder header, which playback rejects
+static void testFullDisk() {
+    FILE* full = fopen("/dev/full", "wb");
+    if (!full) {
+        return;
+    }
+    fclose(full);
+
+    FlagRecorder recorder("/dev/full", WIDTH, HEIGHT);
+    for (uint32_t frame = 0; frame < 1000; ++frame) {
+        recorder.addFrame(makeFrame(frame).data(), float(frame));
+    }
+    CHECK(!recorder.close());
+}
+
+int main() {
+    testRoundTrip();
+    testInvalidFiles();
+    testFullDisk();
+    return checkResult();
+}
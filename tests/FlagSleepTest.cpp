@@ -0,0 +1,73 @@
+#include "Check.hpp"
+
+#include <Utils/Flag.h>
+
+static const float DT = 0.01f;
+
+// Gravity and wind of the demo, given as a force field
+static std::vector<glm::vec3> makeField(const Flag& flag) {
+    return std::vector<glm::vec3>(flag.positionArray.size(), glm::vec3(0.f, -0.002f, 0.f) + glm::vec3(0.02f, 0.f, -0.002f));
+}
+
+static void step(Flag& flag, const std::vector<glm::vec3>& field) {
+    flag.applyExternalForces(field.data());
+    flag.applyInternalForces(DT);
+    flag.update(DT);
+}
+
+// Flag stepped once under the field, then put to sleep as a settled flag would be
+static Flag makeSleepingFlag(const std::vector<glm::vec3>& field) {
+    Flag flag(4096.f, 4.f, 3.f, 32, 16);
+    flag.sleepThreshold = 1e-6f;
+    step(flag, field);
+
+    std::fill(flag.tileSleepingArray.begin(), flag.tileSleepingArray.end(), 1);
+    flag.sleepingTileCount = flag.tileSleepingArray.size();
+    std::fill(flag.velocityArray.begin(), flag.velocityArray.end(), glm::vec3(0.f));
+    return flag;
+}
+
+// A field changing by tiny amounts every step, as the turbulence does, lets the flag sleep
+static void testTinyChanges() {
+    Flag initial(4096.f, 4.f, 3.f, 32, 16);
+    std::vector<glm::vec3> field = makeField(initial);
+    Flag flag = makeSleepingFlag(field);
+
+    for (int s = 0; s < 100; ++s) {
+        for (size_t k = 0; k < field.size(); ++k) {
+            field[k].z += (s % 2 ? 1e-9f : -1e-9f) * (k % 7);
+        }
+        step(flag, field);
+    }
+    CHECK(flag.sleepingTileCount == flag.tileSleepingArray.size());
+}
+
+// A large change of the field wakes the tiles under it, not the whole flag
+static void testLocalChange() {
+    Flag initial(4096.f, 4.f, 3.f, 32, 16);
+    std::vector<glm::vec3> field = makeField(initial);
+    Flag flag = makeSleepingFlag(field);
+    CHECK(flag.tileCountX == 4 && flag.tileCountY == 2);
+
+    // Gust on a single vertex of the first tile, far from the last column of tiles
+    field[flag.index(Flag::TILE_SIZE / 2, Flag::TILE_SIZE / 2)].z += 0.05f;
+    step(flag, field);
+
+    CHECK(!flag.tileSleepingArray[flag.tileIndex(0, 0)]);
+    CHECK(flag.sleepingTileCount == flag.tileSleepingArray.size() - 1);
+    for (uint j = 0; j < flag.tileCountY; ++j) {
+        CHECK(flag.tileSleepingArray[flag.tileIndex(31, j * Flag::TILE_SIZE)]);
+    }
+
+    // A uniform change of wind still wakes everything
+    Flag uniform = makeSleepingFlag(makeField(initial));
+    uniform.applyExternalForce(glm::vec3(0.f, 0.f, 0.01f));
+    step(uniform, makeField(initial));
+    CHECK(uniform.sleepingTileCount == 0);
+}
+
+int main() {
+    testTinyChanges();
+    testLocalChange();
+    return checkResult();
+}
@@ -0,0 +1,173 @@
+#include "Check.hpp"
+
+#include <Utils/FlagSnapshot.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace Utils;
+
+static const char* SNAPSHOT_PATH = "FlagSnapshotTest.flagsnap";
+
+// Gravity and wind of the demo
+static void step(Flag& flag) {
+    flag.applyExternalForce(glm::vec3(0.f, -0.002f, 0.f));
+    flag.applyExternalForce(glm::vec3(0.02f, 0.f, -0.002f));
+    flag.applyInternalForces(0.01f);
+    flag.update(0.01f);
+}
+
+// Flag moved away from its rest state, with a stiffer region and a few torn springs
+static Flag makeFlag(FlagLayout layout) {
+    Flag flag(4096.f, 4.f, 3.f, 16, 16, layout);
+    flag.tearStrain = 0.5f;
+    flag.setMaterial(4, 4, 8, 8, flag.addMaterial(50.f, 2.f, 1.f, 1.f, 0.01f, 0.1f));
+    for (int s = 0; s < 20; ++s) {
+        step(flag);
+    }
+    flag.tearSpring(3, 5, SPRING_RIGHT);
+    flag.tearSpring(7, 2, SPRING_DOWN_LEFT);
+    flag.tearSpring(10, 10, SPRING_DOWN2);
+    return flag;
+}
+
+template<typename T>
+static bool sameBytes(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && !memcmp(a.data(), b.data(), a.size() * sizeof(T));
+}
+
+static std::vector<uint> sorted(std::vector<uint> array) {
+    std::sort(array.begin(), array.end());
+    return array;
+}
+
+static void testRoundTrip(FlagLayout layout) {
+    Flag flag = makeFlag(layout);
+    std::vector<Sphere> spheres = { Sphere(glm::vec3(0.f, 0.f, 1.f), 0.5f), Sphere(glm::vec3(1.f, 2.f, 3.f), 0.25f) };
+    CHECK(saveSnapshot(SNAPSHOT_PATH, flag, spheres));
+
+    // Loaded over a flag of another size, with tears of its own
+    Flag loaded(1.f, 1.f, 1.f, 5, 4);
+    loaded.tearSpring(1, 1, SPRING_DOWN_RIGHT);
+    std::vector<Sphere> loadedSpheres;
+    CHECK(loadSnapshot(SNAPSHOT_PATH, loaded, loadedSpheres));
+
+    CHECK(loaded.gridWidth == flag.gridWidth && loaded.gridHeight == flag.gridHeight);
+    CHECK(loaded.layout == flag.layout);
+    CHECK(loaded.L0 == flag.L0 && loaded.L1 == flag.L1 && loaded.L2 == flag.L2);
+    CHECK(loaded.K0 == flag.K0 && loaded.K1 == flag.K1 && loaded.K2 == flag.K2);
+    CHECK(loaded.V0 == flag.V0 && loaded.V1 == flag.V1 && loaded.V2 == flag.V2);
+    CHECK(sameBytes(loaded.positionArray, flag.positionArray));
+    CHECK(sameBytes(loaded.velocityArray, flag.velocityArray));
+    CHECK(sameBytes(loaded.massArray, flag.massArray));
+    CHECK(sameBytes(loaded.materialArray, flag.materialArray));
+    CHECK(sameBytes(loaded.materialIndexArray, flag.materialIndexArray));
+    CHECK(loaded.tearStrain == flag.tearStrain);
+
+    // The torn springs are torn again, giving the renderer the same triangles
+    CHECK(sameBytes(loaded.springMaskArray, flag.springMaskArray));
+    CHECK(sorted(loaded.tornTriangleArray) == sorted(flag.tornTriangleArray));
+    CHECK(sameBytes(loaded.faceTornArray, flag.faceTornArray));
+
+    CHECK(loadedSpheres.size() == spheres.size());
+    for (size_t s = 0; s < std::min(loadedSpheres.size(), spheres.size()); ++s) {
+        CHECK(loadedSpheres[s].center == spheres[s].center && loadedSpheres[s].radius == spheres[s].radius);
+    }
+
+    // Both step on identically
+    for (int s = 0; s < 5; ++s) {
+        step(flag);
+        step(loaded);
+    }
+    CHECK(sameBytes(loaded.positionArray, flag.positionArray));
+
+    remove(SNAPSHOT_PATH);
+}
+
+static void testInvalidFiles() {
+    Flag flag = makeFlag(ROW_MAJOR);
+    std::vector<Sphere> spheres = { Sphere(glm::vec3(0.f), 1.f) };
+    CHECK(saveSnapshot(SNAPSHOT_PATH, flag, spheres));
+
+    std::vector<char> contents;
+    FILE* file = fopen(SNAPSHOT_PATH, "rb");
+    CHECK(file);
+    for (int c; file && (c = fgetc(file)) != EOF; ) {
+        contents.push_back(char(c));
+    }
+    if (file) {
+        fclose(file);
+    }
+
+    auto rewrite = [&](const std::vector<char>& bytes) {
+        FILE* file = fopen(SNAPSHOT_PATH, "wb");
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fclose(file);
+    };
+
+    // A failed load leaves the flag and the spheres untouched
+    Flag untouched(1.f, 1.f, 1.f, 5, 4);
+    std::vector<Sphere> untouchedSpheres;
+    auto checkRejected = [&]() {
+        CHECK(!loadSnapshot(SNAPSHOT_PATH, untouched, untouchedSpheres));
+        CHECK(untouched.gridWidth == 5 && untouched.gridHeight == 4 && untouched.positionArray.size() == 20);
+        CHECK(untouchedSpheres.empty());
+    };
+
+    std::vector<char> truncated(contents.begin(), contents.begin() + contents.size() / 2);
+    rewrite(truncated);
+    checkRejected();
+
+    std::vector<char> badMagic = contents;
+    badMagic[0] = 'X';
+    rewrite(badMagic);
+    checkRejected();
+
+    std::vector<char> badVersion = contents;
+    badVersion[8] ^= 0xFF;
+    rewrite(badVersion);
+    checkRejected();
+
+    remove(SNAPSHOT_PATH);
+    CHECK(!loadSnapshot(SNAPSHOT_PATH, untouched, untouchedSpheres));
+}
+
+static void testKeyAndCache() {
+    Flag flag = makeFlag(ROW_MAJOR);
+    std::vector<Sphere> spheres = { Sphere(glm::vec3(0.f), 1.f) };
+    const glm::vec3 gravity(0.f, -9.81f, 0.f), wind(1.f, 0.f, 0.f);
+
+    uint64_t key = snapshotKey(flag, spheres, gravity, wind, 0.01f, 100);
+    CHECK(key == snapshotKey(makeFlag(ROW_MAJOR), spheres, gravity, wind, 0.01f, 100));
+    CHECK(key != snapshotKey(flag, spheres, gravity, glm::vec3(2.f, 0.f, 0.f), 0.01f, 100));
+    CHECK(key != snapshotKey(flag, spheres, gravity, wind, 0.02f, 100));
+    CHECK(key != snapshotKey(flag, spheres, gravity, wind, 0.01f, 101));
+    CHECK(key != snapshotKey(flag, std::vector<Sphere>(), gravity, wind, 0.01f, 100));
+
+    Flag torn = flag;
+    torn.tearSpring(0, 0, SPRING_RIGHT);
+    CHECK(key != snapshotKey(torn, spheres, gravity, wind, 0.01f, 100));
+
+    SnapshotCache cache("FlagSnapshotTestCache");
+    Flag loaded(1.f, 1.f, 1.f, 5, 4);
+    std::vector<Sphere> loadedSpheres;
+    CHECK(!cache.load(key, loaded, loadedSpheres));
+    CHECK(cache.save(key, flag, spheres));
+    CHECK(cache.load(key, loaded, loadedSpheres));
+    CHECK(sameBytes(loaded.positionArray, flag.positionArray));
+    CHECK(!cache.load(key + 1, loaded, loadedSpheres));
+
+    char path[64];
+    snprintf(path, sizeof(path), "FlagSnapshotTestCache/%llx.flagsnap", (unsigned long long) key);
+    remove(path);
+    remove("FlagSnapshotTestCache");
+}
+
+int main() {
+    testRoundTrip(ROW_MAJOR);
+    testRoundTrip(TILED);
+    testInvalidFiles();
+    testKeyAndCache();
+    return checkResult();
+}
@@ -0,0 +1,153 @@
+#include "Check.hpp"
+
+#include <Utils/Flag.h>
+
+#include <algorithm>
+#include <set>
+
+// Vertices of the triangle t of the row-major grid: the quad (i, j) is split into
+// (i, j) (i + 1, j) (i + 1, j + 1) and (i, j) (i + 1, j + 1) (i, j + 1)
+static std::set<uint> triangleVertices(const Flag& flag, uint t) {
+    const uint w = flag.gridWidth, quad = t / 2, i = quad % (w - 1), j = quad / (w - 1);
+    if (t % 2 == 0) {
+        return { i + j * w, i + 1 + j * w, i + 1 + (j + 1) * w };
+    }
+    return { i + j * w, i + 1 + (j + 1) * w, i + (j + 1) * w };
+}
+
+static uint triangleCount(const Flag& flag) {
+    return 2 * (flag.gridWidth - 1) * (flag.gridHeight - 1);
+}
+
+// Row-major vertex at the other end of the spring from (i, j)
+static bool springEnd(const Flag& flag, uint i, uint j, SpringDirection direction, uint& end) {
+    static const int DI[SPRING_DIRECTION_COUNT] = { 1, 0, 1, -1, 2, 0 };
+    static const int DJ[SPRING_DIRECTION_COUNT] = { 0, 1, 1, 1, 0, 2 };
+    const int ei = int(i) + DI[direction], ej = int(j) + DJ[direction];
+    if (ei < 0 || ej < 0 || ei >= int(flag.gridWidth) || ej >= int(flag.gridHeight)) {
+        return false;
+    }
+    end = ei + ej * flag.gridWidth;
+    return true;
+}
+
+// Triangles torn with the spring from (i, j): those it is an edge of, or both triangles of
+// the quad it crosses for the diagonal that is not an edge
+static std::set<uint> springTriangles(const Flag& flag, uint i, uint j, SpringDirection direction) {
+    std::set<uint> triangles;
+    uint end;
+    if (!springEnd(flag, i, j, direction, end)) {
+        return triangles;
+    }
+    if (direction == SPRING_DOWN_LEFT) {
+        const uint quad = i - 1 + j * (flag.gridWidth - 1);
+        return { 2 * quad, 2 * quad + 1 };
+    }
+    for (uint t = 0; t < triangleCount(flag); ++t) {
+        std::set<uint> vertices = triangleVertices(flag, t);
+        if (vertices.count(i + j * flag.gridWidth) && vertices.count(end)) {
+            triangles.insert(t);
+        }
+    }
+    return triangles;
+}
+
+// Every spring tears its triangles, and only those
+static void testTriangleBookkeeping() {
+    for (uint j = 0; j < 4; ++j) {
+        for (uint i = 0; i < 5; ++i) {
+            for (int d = 0; d < SPRING_DIRECTION_COUNT; ++d) {
+                const SpringDirection direction = SpringDirection(d);
+                Flag flag(4096.f, 4.f, 3.f, 5, 4);
+                uint end;
+                if (!springEnd(flag, i, j, direction, end)) {
+                    continue;
+                }
+
+                flag.tearSpring(i, j, direction);
+                CHECK(flag.springMaskArray.size() == 20);
+                for (uint k = 0; k < 20; ++k) {
+                    CHECK(flag.springMaskArray[k] == (k == i + j * 5 ? 63 & ~(1 << d) : 63));
+                }
+
+                const std::set<uint> expected = springTriangles(flag, i, j, direction);
+                CHECK(direction < SPRING_RIGHT2 || expected.empty());
+                std::set<uint> torn(flag.tornTriangleArray.begin(), flag.tornTriangleArray.end());
+                CHECK(torn == expected);
+                CHECK(torn.size() == flag.tornTriangleArray.size());
+
+                // Only the torn triangles stop catching air
+                if (expected.empty()) {
+                    CHECK(flag.faceTornArray.empty());
+                } else {
+                    CHECK(flag.faceTornArray.size() == triangleCount(flag));
+                    for (uint t = 0; t < flag.faceTornArray.size(); ++t) {
+                        CHECK(bool(flag.faceTornArray[t]) == bool(expected.count(t)));
+                    }
+                }
+
+                // Tearing a torn spring again changes nothing
+                const size_t tornCount = flag.tornTriangleArray.size();
+                flag.tearSpring(i, j, direction);
+                CHECK(flag.tornTriangleArray.size() == tornCount);
+            }
+        }
+    }
+}
+
+// A vertex pulled far from the flag breaks every spring it is an end of, and nothing else
+static void testStrain(FlagLayout layout, std::vector<uint8_t>& rowMajorMask, std::set<uint>& torn) {
+    const uint I = 8, J = 8;
+    Flag flag(4096.f, 4.f, 3.f, 16, 16, layout);
+    CHECK(flag.layout == layout);
+    flag.tearStrain = 0.5f;
+    flag.positionArray[flag.index(I, J)].z += 10.f;
+    flag.applyInternalForces(0.01f);
+
+    rowMajorMask.assign(16 * 16, 0);
+    std::set<uint> expected;
+    for (uint j = 0; j < 16; ++j) {
+        for (uint i = 0; i < 16; ++i) {
+            const uint8_t mask = flag.springMaskArray[flag.index(i, j)];
+            rowMajorMask[i + j * 16] = mask;
+            for (int d = 0; d < SPRING_DIRECTION_COUNT; ++d) {
+                uint end;
+                const bool pulled = springEnd(flag, i, j, SpringDirection(d), end) && (i + j * 16 == I + J * 16 || end == I + J * 16);
+                CHECK(bool(mask & (1 << d)) == !pulled);
+                if (pulled) {
+                    const std::set<uint> triangles = springTriangles(flag, i, j, SpringDirection(d));
+                    expected.insert(triangles.begin(), triangles.end());
+                }
+            }
+        }
+    }
+
+    // The 6 triangles around the vertex, and the 2 crossed by the diagonals that are not edges
+    torn = std::set<uint>(flag.tornTriangleArray.begin(), flag.tornTriangleArray.end());
+    CHECK(torn == expected);
+    CHECK(expected.size() == 8);
+}
+
+// Without a tear strain nothing breaks, and the mask is never allocated
+static void testNoTearing() {
+    Flag flag(4096.f, 4.f, 3.f, 16, 16);
+    flag.positionArray[flag.index(8, 8)].z += 10.f;
+    flag.applyInternalForces(0.01f);
+    CHECK(flag.springMaskArray.empty());
+    CHECK(flag.tornTriangleArray.empty());
+    CHECK(flag.faceTornArray.empty());
+}
+
+int main() {
+    testTriangleBookkeeping();
+
+    std::vector<uint8_t> rowMajorMask, tiledMask;
+    std::set<uint> rowMajorTorn, tiledTorn;
+    testStrain(ROW_MAJOR, rowMajorMask, rowMajorTorn);
+    testStrain(TILED, tiledMask, tiledTorn);
+    CHECK(rowMajorMask == tiledMask);
+    CHECK(rowMajorTorn == tiledTorn);
+
+    testNoTearing();
+    return checkResult();
+}
@@ -0,0 +1,163 @@
+#include "Check.hpp"
+
+#include <Utils/renderer/GridStrips.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <set>
+
+using namespace Utils;
+
+typedef uint16_t Index;
+typedef std::array<int, 3> Triangle;
+
+static const Index RESTART_INDEX = 0xFFFF;
+
+// Same vertices in the same cyclic order, starting from the smallest
+static Triangle canonical(Triangle t) {
+    std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+    return t;
+}
+
+// Triangles drawn by strips separated by restarts, the odd ones of each strip swapped as GL does.
+// Degenerate ones are dropped.
+static std::vector<Triangle> stripTriangles(const std::vector<Index>& indexBuffer) {
+    std::vector<Triangle> triangles;
+    size_t start = 0;
+    for (size_t k = 0; k < indexBuffer.size(); ++k) {
+        if (indexBuffer[k] == RESTART_INDEX) {
+            start = k + 1;
+            continue;
+        }
+        if (k < start + 2) {
+            continue;
+        }
+        Triangle t = (k - start) % 2 == 0 ? Triangle{ { indexBuffer[k - 2], indexBuffer[k - 1], indexBuffer[k] } } :
+                                       Triangle{ { indexBuffer[k - 1], indexBuffer[k - 2], indexBuffer[k] } };
+        if (t[0] != t[1] && t[1] != t[2] && t[0] != t[2]) {
+            triangles.push_back(t);
+        }
+    }
+    return triangles;
+}
+
+// Twice the signed area in grid coordinates, positive with the winding of Flag's triangles
+static int doubleArea(const Triangle& t, int gridWidth) {
+    const int x0 = t[0] % gridWidth, y0 = t[0] / gridWidth;
+    const int x1 = t[1] % gridWidth, y1 = t[1] / gridWidth;
+    const int x2 = t[2] % gridWidth, y2 = t[2] / gridWidth;
+    return (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+}
+
+// Triangle t of Flag's numbering: the quad (i, j) is split into (i, j) (i + 1, j) (i + 1, j + 1)
+// and (i, j) (i + 1, j + 1) (i, j + 1)
+static Triangle flagTriangle(int t, int gridWidth) {
+    const int quad = t / 2, k = quad % (gridWidth - 1) + quad / (gridWidth - 1) * gridWidth;
+    return t % 2 ? Triangle{ { k, k + 1 + gridWidth, k + gridWidth } } : Triangle{ { k, k + 1, k + 1 + gridWidth } };
+}
+
+static void testGrid(int gridWidth, int gridHeight, const std::vector<bool>& tornTriangleArray, int step) {
+    std::vector<Index> indexBuffer;
+    buildGridStrips(gridWidth, gridHeight, tornTriangleArray, indexBuffer, step);
+
+    // Rebuilding the rows one by one gives the same buffer, each row within its slot
+    const int rowCount = gridStripRowCount(gridHeight, step);
+    std::vector<Index> rows;
+    for (int r = 0; r < rowCount; ++r) {
+        std::vector<Index> row;
+        buildGridStripRow(gridWidth, gridHeight, tornTriangleArray, r, row, step);
+        CHECK(int(row.size()) <= gridStripRowCapacity(gridWidth, step));
+        CHECK(row.empty() || row.back() == RESTART_INDEX);
+        rows.insert(rows.end(), row.begin(), row.end());
+    }
+    CHECK(rows == indexBuffer);
+
+    // Every fine row falls in a coarse one
+    for (int j = 0; j + 1 < gridHeight; ++j) {
+        CHECK(gridStripRow(j, step) < rowCount);
+        CHECK(j == 0 || gridStripRow(j, step) - gridStripRow(j - 1, step) <= 1);
+    }
+
+    const std::vector<Triangle> triangles = stripTriangles(indexBuffer);
+    for (const Triangle& t : triangles) {
+        CHECK(doubleArea(t, gridWidth) > 0);
+    }
+
+    const int triangleCount = 2 * (gridWidth - 1) * (gridHeight - 1);
+    auto torn = [&](int t) {
+        return !tornTriangleArray.empty() && tornTriangleArray[t];
+    };
+
+    if (step == 1) {
+        // Exactly the triangles left, with their winding
+        std::multiset<Triangle> drawn, expected;
+        for (const Triangle& t : triangles) {
+            drawn.insert(canonical(t));
+        }
+        for (int t = 0; t < triangleCount; ++t) {
+            if (!torn(t)) {
+                expected.insert(canonical(flagTriangle(t, gridWidth)));
+            }
+        }
+        CHECK(drawn == expected);
+        return;
+    }
+
+    // Coarse triangles cover only untorn quads, and the whole grid when nothing is torn
+    int coveredArea = 0;
+    for (const Triangle& t : triangles) {
+        coveredArea += doubleArea(t, gridWidth);
+        int i0 = gridWidth, i1 = 0, j0 = gridHeight, j1 = 0;
+        for (int k : t) {
+            i0 = std::min(i0, k % gridWidth);
+            i1 = std::max(i1, k % gridWidth);
+            j0 = std::min(j0, k / gridWidth);
+            j1 = std::max(j1, k / gridWidth);
+        }
+        for (int j = j0; j < j1; ++j) {
+            for (int i = i0; i < i1; ++i) {
+                CHECK(!torn(2 * (i + j * (gridWidth - 1))) && !torn(2 * (i + j * (gridWidth - 1)) + 1));
+            }
+        }
+    }
+    if (tornTriangleArray.empty()) {
+        CHECK(coveredArea == triangleCount);
+    }
+}
+
+int main() {
+    const int SIZES[][2] = { { 2, 2 }, { 5, 4 }, { 17, 9 }, { 32, 16 } };
+    uint32_t seed = 12345;
+
+    for (const int* size : SIZES) {
+        const int w = size[0], h = size[1], triangleCount = 2 * (w - 1) * (h - 1);
+
+        std::vector<std::vector<bool> > patterns;
+        patterns.push_back(std::vector<bool>());
+        for (int parity = 0; parity < 2; ++parity) {
+            // Every other triangle, the worst case for the slots
+            std::vector<bool> alternate(triangleCount);
+            for (int t = 0; t < triangleCount; ++t) {
+                alternate[t] = t % 2 == parity;
+            }
+            patterns.push_back(alternate);
+        }
+        patterns.push_back(std::vector<bool>(triangleCount, true));
+        for (int n = 0; n < 8; ++n) {
+            std::vector<bool> random(triangleCount);
+            for (int t = 0; t < triangleCount; ++t) {
+                seed = seed * 1664525u + 1013904223u;
+                random[t] = (seed >> 24) < 40;
+            }
+            patterns.push_back(random);
+        }
+
+        for (const std::vector<bool>& pattern : patterns) {
+            for (int step = 1; step <= 4; step *= 2) {
+                testGrid(w, h, pattern, step);
+            }
+        }
+    }
+    return checkResult();
+}
@@ -0,0 +1,253 @@
+#include "Check.hpp"
+
+#include <Utils/ImageSequenceWriter.hpp>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace Utils;
+
+static std::vector<uint8_t> readFile(const char* path) {
+    std::vector<uint8_t> contents;
+    FILE* file = fopen(path, "rb");
+    CHECK(file);
+    for (int c; file && (c = fgetc(file)) != EOF; ) {
+        contents.push_back(uint8_t(c));
+    }
+    if (file) {
+        fclose(file);
+    }
+    return contents;
+}
+
+static uint32_t bigEndian(const uint8_t* bytes) {
+    return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 8 | bytes[3];
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t k = 0; k < size; ++k) {
+        crc ^= data[k];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+// Data of a zlib stream
+static bool inflateZlib(const std::vector<uint8_t>& stream, size_t size, std::vector<uint8_t>& data) {
+    data.resize(size);
+#ifdef USE_ZLIB
+    uLongf dataSize = size;
+    return uncompress(data.data(), &dataSize, stream.data(), stream.size()) == Z_OK && dataSize == size;
+#else
+    // Stored blocks only
+    data.clear();
+    size_t offset = 2;
+    for (bool last = false; !last; ) {
+        if (offset + 5 > stream.size() || (stream[offset] & 6)) {
+            return false;
+        }
+        last = stream[offset] & 1;
+        const size_t blockSize = stream[offset + 1] | stream[offset + 2] << 8;
+        if ((blockSize ^ (stream[offset + 3] | stream[offset + 4] << 8)) != 0xFFFF || offset + 5 + blockSize > stream.size()) {
+            return false;
+        }
+        data.insert(data.end(), &stream[offset + 5], &stream[offset + 5] + blockSize);
+        offset += 5 + blockSize;
+    }
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : data) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    return offset + 4 == stream.size() && bigEndian(&stream[offset]) == (b << 16 | a) && data.size() == size;
+#endif
+}
+
+// RGBA rows from the bottom up, every pixel different
+static std::vector<uint8_t> makeFrame(uint32_t width, uint32_t height, uint8_t seed) {
+    std::vector<uint8_t> pixels(width * height * 4);
+    for (size_t k = 0; k < pixels.size(); ++k) {
+        pixels[k] = uint8_t(seed + 37 * k);
+    }
+    return pixels;
+}
+
+static void testPatterns() {
+    const char* REJECTED[] = { "frame.png", "frame%d%d.png", "frame%s.png", "100%%_%d.png", "frame%n.png", "frame%", "%x.png", "%ld.png" };
+    for (const char* pattern : REJECTED) {
+        bool thrown = false;
+        try {
+            ImageSequenceWriter writer(pattern, 4, 4);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+
+    const char* ACCEPTED[] = { "ImageSequenceWriterTest%04d.png", "ImageSequenceWriterTest%+3i.png", "ImageSequenceWriterTest%u.png" };
+    for (const char* pattern : ACCEPTED) {
+        bool thrown = false;
+        try {
+            ImageSequenceWriter writer(pattern, 4, 4);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(!thrown);
+    }
+
+    bool thrown = false;
+    try {
+        ImageSequenceWriter writer("no/such/directory/video.y4m", 4, 4);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+static void testPNG() {
+    const uint32_t width = 5, height = 3, frameCount = 3;
+    std::vector<std::vector<uint8_t> > frames;
+    {
+        ImageSequenceWriter writer("ImageSequenceWriterTest%02d.png", width, height);
+        for (uint32_t frame = 0; frame < frameCount; ++frame) {
+            std::vector<uint8_t> pixels = writer.takeBuffer();
+            CHECK(pixels.size() == width * height * 4);
+            frames.push_back(makeFrame(width, height, frame));
+            pixels = frames.back();
+            writer.addFrame(std::move(pixels));
+        }
+    }
+
+    for (uint32_t frame = 0; frame < frameCount; ++frame) {
+        char path[64];
+        snprintf(path, sizeof(path), "ImageSequenceWriterTest%02u.png", frame);
+        const std::vector<uint8_t> png = readFile(path);
+        remove(path);
+
+        static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        CHECK(png.size() > sizeof(SIGNATURE) && !memcmp(png.data(), SIGNATURE, sizeof(SIGNATURE)));
+
+        // IHDR, IDAT and IEND, each with a valid CRC
+        std::vector<std::string> types;
+        std::vector<uint8_t> header, compressed;
+        for (size_t offset = sizeof(SIGNATURE); offset + 12 <= png.size(); ) {
+            const uint32_t size = bigEndian(&png[offset]);
+            if (offset + 12 + size > png.size()) {
+                break;
+            }
+            const std::string type(png.begin() + offset + 4, png.begin() + offset + 8);
+            const uint8_t* data = &png[offset + 8];
+            CHECK(bigEndian(data + size) == crc32(&png[offset + 4], 4 + size));
+            types.push_back(type);
+            if (type == "IHDR") {
+                header.assign(data, data + size);
+            } else if (type == "IDAT") {
+                compressed.insert(compressed.end(), data, data + size);
+            }
+            offset += 12 + size;
+        }
+        CHECK((types == std::vector<std::string>{ "IHDR", "IDAT", "IEND" }));
+
+        // 8 bits RGB, not interlaced
+        CHECK(header.size() == 13);
+        if (header.size() == 13) {
+            CHECK(bigEndian(&header[0]) == width && bigEndian(&header[4]) == height);
+            CHECK(header[8] == 8 && header[9] == 2 && header[10] == 0 && header[11] == 0 && header[12] == 0);
+        }
+
+        // Rows from the top, each one after its filter type
+        std::vector<uint8_t> rows;
+        CHECK(inflateZlib(compressed, (3 * width + 1) * height, rows));
+        for (uint32_t y = 0; y < height && rows.size() == (3 * width + 1) * height; ++y) {
+            const uint8_t* row = &rows[(3 * width + 1) * y];
+            CHECK(row[0] == 0);
+            for (uint32_t x = 0; x < width; ++x) {
+                const uint8_t* pixel = &frames[frame][4 * (x + (height - 1 - y) * width)];
+                CHECK(!memcmp(&row[1 + 3 * x], pixel, 3));
+            }
+        }
+    }
+}
+
+// Frames of a single color, but for the bottom row
+static std::vector<uint8_t> makeFrame(uint32_t width, uint32_t height, const uint8_t color[3], const uint8_t bottom[3]) {
+    std::vector<uint8_t> pixels(width * height * 4, 255);
+    for (uint32_t k = 0; k < width * height; ++k) {
+        memcpy(&pixels[4 * k], k < width ? bottom : color, 3);
+    }
+    return pixels;
+}
+
+static void testY4M(uint32_t width, uint32_t height) {
+    const uint8_t BLACK[3] = { 0, 0, 0 }, WHITE[3] = { 255, 255, 255 }, RED[3] = { 255, 0, 0 };
+    const char* PATH = "ImageSequenceWriterTest.y4m";
+    {
+        ImageSequenceWriter writer(PATH, width, height, 30);
+        writer.addFrame(makeFrame(width, height, BLACK, BLACK));
+        writer.addFrame(makeFrame(width, height, WHITE, WHITE));
+        writer.addFrame(makeFrame(width, height, RED, RED));
+        writer.addFrame(makeFrame(width, height, BLACK, WHITE));
+    }
+    const std::vector<uint8_t> y4m = readFile(PATH);
+    remove(PATH);
+
+    char expectedHeader[128];
+    snprintf(expectedHeader, sizeof(expectedHeader), "YUV4MPEG2 W%u H%u F30:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height);
+    const size_t headerSize = strlen(expectedHeader);
+    CHECK(y4m.size() > headerSize && !memcmp(y4m.data(), expectedHeader, headerSize));
+
+    const uint32_t chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    const size_t lumaSize = width * height, chromaSize = chromaWidth * chromaHeight;
+    const size_t frameSize = 6 + lumaSize + 2 * chromaSize;
+    CHECK(y4m.size() == headerSize + 4 * frameSize);
+    if (y4m.size() != headerSize + 4 * frameSize) {
+        return;
+    }
+
+    // Limited range BT.601: luma in [16, 235], chroma centred on 128
+    const uint8_t EXPECTED[3][3] = { { 16, 128, 128 }, { 235, 128, 128 }, { 81, 90, 240 } };
+    for (int frame = 0; frame < 4; ++frame) {
+        const uint8_t* data = &y4m[headerSize + frame * frameSize];
+        CHECK(!memcmp(data, "FRAME\n", 6));
+        const uint8_t* Y = data + 6;
+        const uint8_t* U = Y + lumaSize;
+        const uint8_t* V = U + chromaSize;
+
+        if (frame < 3) {
+            for (size_t k = 0; k < lumaSize; ++k) {
+                CHECK(Y[k] == EXPECTED[frame][0]);
+            }
+            for (size_t k = 0; k < chromaSize; ++k) {
+                CHECK(U[k] == EXPECTED[frame][1] && V[k] == EXPECTED[frame][2]);
+            }
+            continue;
+        }
+
+        // The bottom row of the frame, first in memory, is the last one of the picture
+        for (uint32_t y = 0; y < height; ++y) {
+            for (uint32_t x = 0; x < width; ++x) {
+                CHECK(Y[x + y * width] == (y + 1 == height ? 235 : 16));
+            }
+        }
+        for (size_t k = 0; k < chromaSize; ++k) {
+            CHECK(U[k] == 128 && V[k] == 128);
+        }
+    }
+}
+
+int main() {
+    testPatterns();
+    testPNG();
+    testY4M(4, 2);
+    testY4M(5, 3);
+    return checkResult();
+}
@@ -0,0 +1,160 @@
+#include "Check.hpp"
+
+#include <Utils/TimestepController.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace Utils;
+
+static const float FRAME_DT = 1.f / 60.f;
+
+// Gravity and wind of the demo
+static void step(Flag& flag, float dt) {
+    flag.applyExternalForce(glm::vec3(0.f, -0.002f, 0.f));
+    flag.applyExternalForce(glm::vec3(0.02f, 0.f, -0.002f));
+    flag.applyInternalForces(dt);
+    flag.update(dt);
+}
+
+template<typename T>
+static bool sameBytes(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && !memcmp(a.data(), b.data(), a.size() * sizeof(T));
+}
+
+static bool finite(const Flag& flag) {
+    for (size_t k = 0; k < flag.positionArray.size(); ++k) {
+        const glm::vec3& p = flag.positionArray[k];
+        const glm::vec3& v = flag.velocityArray[k];
+        if (!std::isfinite(p.x + p.y + p.z + v.x + v.y + v.z)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Flag with torn springs and a sleeping tile, whose state a rollback must bring back
+static Flag makeFlag() {
+    Flag flag(4096.f, 4.f, 3.f, 32, 16);
+    flag.tearStrain = 1.f;
+    flag.sleepThreshold = 1e-6f;
+    flag.tearSpring(5, 5, SPRING_DOWN_RIGHT);
+    flag.tileSleepingArray[2] = 1;
+    flag.tileQuietStepArray[2] = 40;
+    flag.tileQuietStepArray[3] = 7;
+    flag.sleepingTileCount = 1;
+    return flag;
+}
+
+static void testStable() {
+    Flag flag(4096.f, 4.f, 3.f, 32, 16);
+    TimestepController controller(1e-4f, FRAME_DT);
+
+    for (int frame = 0; frame < 60; ++frame) {
+        float time = 0.f;
+        const float advanced = controller.advance(flag, FRAME_DT, [&](float dt) {
+            step(flag, dt);
+            time += dt;
+        });
+        CHECK(controller.getSubstepCount() >= 1);
+        CHECK(std::abs(time - FRAME_DT) < 1e-6f);
+        CHECK(advanced == time);
+    }
+    CHECK(controller.getRollbackCount() == 0);
+    CHECK(finite(flag));
+    CHECK(controller.getTimestep() <= FRAME_DT);
+}
+
+// Substeps too small to cover the frame: the time advanced falls short of it
+static void testSubstepBudget() {
+    Flag flag(4096.f, 4.f, 3.f, 32, 16);
+    TimestepController controller(1e-5f, 1e-4f);
+
+    float time = 0.f;
+    const float advanced = controller.advance(flag, FRAME_DT, [&](float dt) {
+        step(flag, dt);
+        time += dt;
+    });
+    CHECK(advanced == time);
+    CHECK(advanced > 0.f && advanced < FRAME_DT);
+    CHECK(controller.getRollbackCount() == 0);
+}
+
+// The first substep tears springs, changes the sleep state and blows up
+static void testRollback(bool nan) {
+    Flag flag = makeFlag();
+    const Flag initial = flag;
+    TimestepController controller(1e-4f, FRAME_DT);
+
+    uint32_t stepCount = 0;
+    float firstDt = 0.f, secondDt = 0.f;
+    controller.advance(flag, FRAME_DT, [&](float dt) {
+        if (++stepCount > 2) {
+            return;
+        }
+        if (stepCount == 2) {
+            secondDt = dt;
+            return;
+        }
+        firstDt = dt;
+        flag.tearSpring(10, 3, SPRING_RIGHT);
+        flag.tearSpring(20, 8, SPRING_DOWN);
+        flag.tileSleepingArray[0] = 1;
+        flag.tileQuietStepArray[3] = 8;
+        flag.sleepingTileCount = 2;
+        const float speed = nan ? std::numeric_limits<float>::quiet_NaN() : 1000.f;
+        for (size_t k = 0; k < flag.velocityArray.size(); ++k) {
+            flag.velocityArray[k] = glm::vec3(speed);
+            flag.positionArray[k] += glm::vec3(speed);
+        }
+    });
+
+    CHECK(controller.getRollbackCount() == 1);
+    CHECK(secondDt > 0.f && secondDt < firstDt);
+    CHECK(sameBytes(flag.positionArray, initial.positionArray));
+    CHECK(sameBytes(flag.velocityArray, initial.velocityArray));
+    // The torn springs are mended, and their triangles drawn again
+    CHECK(sameBytes(flag.springMaskArray, initial.springMaskArray));
+    CHECK(flag.tornTriangleArray == initial.tornTriangleArray);
+    CHECK(sameBytes(flag.faceTornArray, initial.faceTornArray));
+    // The tiles sleep as before
+    CHECK(sameBytes(flag.tileSleepingArray, initial.tileSleepingArray));
+    CHECK(sameBytes(flag.tileQuietStepArray, initial.tileQuietStepArray));
+    CHECK(flag.sleepingTileCount == initial.sleepingTileCount);
+}
+
+// Even the smallest timestep diverges: the motion is stopped
+static void testDiverging() {
+    Flag flag = makeFlag();
+    const Flag initial = flag;
+    for (glm::vec3& velocity : flag.velocityArray) {
+        velocity = glm::vec3(0.f, 0.f, 0.1f);
+    }
+    TimestepController controller(1e-3f, FRAME_DT);
+
+    controller.advance(flag, FRAME_DT, [&](float) {
+        flag.tearSpring(10, 3, SPRING_RIGHT);
+        for (glm::vec3& velocity : flag.velocityArray) {
+            velocity = glm::vec3(std::numeric_limits<float>::infinity());
+        }
+    });
+
+    CHECK(controller.getRollbackCount() >= 1);
+    CHECK(controller.getTimestep() == 1e-3f);
+    CHECK(sameBytes(flag.positionArray, initial.positionArray));
+    for (const glm::vec3& velocity : flag.velocityArray) {
+        CHECK(velocity == glm::vec3(0.f));
+    }
+    CHECK(sameBytes(flag.springMaskArray, initial.springMaskArray));
+    CHECK(sameBytes(flag.faceTornArray, initial.faceTornArray));
+}
+
+int main() {
+    testStable();
+    testSubstepBudget();
+    testRollback(false);
+    testRollback(true);
+    testDiverging();
+    return checkResult();
+}
@@ -442,6 +442,11 @@ void CTwGraphOpenGLCore::BeginDraw(int _WndWidth, int _WndHeight)
     glGetIntegerv(GL_ACTIVE_TEXTURE, (GLint*)&m_PrevActiveTexture); CHECKgl_ERROR;
     glActiveTexture(GL_TEXTURE0);
 
+    // the application may draw in wireframe
+    m_PrevPolygonMode[0] = m_PrevPolygonMode[1] = GL_FILL;
+    glGetIntegerv(GL_POLYGON_MODE, m_PrevPolygonMode); CHECKgl_ERROR;
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); CHECKgl_ERROR;
+
     CHECKgl_ERROR;
 }
 
@@ -509,6 +514,8 @@ void CTwGraphOpenGLCore::EndDraw()
     
     glBindVertexArray(m_PrevVArray); CHECKgl_ERROR;
 
+    glPolygonMode(GL_FRONT_AND_BACK, m_PrevPolygonMode[0]); CHECKgl_ERROR;
+
     glViewport(m_PrevViewport[0], m_PrevViewport[1], m_PrevViewport[2], m_PrevViewport[3]); CHECKgl_ERROR;
 
     CHECKgl_ERROR;
@@ -60,6 +60,7 @@ protected:
     GLboolean           m_PrevScissorTest;
     GLint               m_PrevScissorBox[4];
     GLint               m_PrevViewport[4];
+    GLint               m_PrevPolygonMode[2];
     GLuint              m_PrevProgramObject;
 
     GLuint              m_LineRectVS;